@@ -61,6 +61,15 @@ Application::Application(char *infile) {
 	en1 = new EmulNet(par);
 	mp1 = (MP1Node **) malloc(par->EN_GPSZ * sizeof(MP1Node *));
 	mp2 = (MP2Node **) malloc(par->EN_GPSZ * sizeof(MP2Node *));
+	membershipConverged = -1;
+	cutOffUntil = 0;
+	hintedUpdates = 0;
+	failedUpdates = 0;
+	hintsStoredBefore = 0;
+	// the node the swap scenario holds back is not waited for
+	if ( par->SCENARIO == SWAP_SCENARIO ) {
+		par->allNodesJoined -= par->EN_GPSZ - 1;
+	}
 
 	/*
 	 * Init all nodes
@@ -119,6 +128,9 @@ int Application::run()
 			timeWhenAllNodesHaveJoined = par->getcurrtime();
 			allNodesJoined = true;
 		}
+		// Inject the faults of a scenario test and check its outcome
+		runScenario();
+
 		if ( par->getcurrtime() > timeWhenAllNodesHaveJoined + 50 ) {
 			// Call the KV store functionalities
 			mp2Run();
@@ -133,6 +145,9 @@ int Application::run()
 
 	for(i=0;i<=par->EN_GPSZ-1;i++) {
 		 mp1[i]->finishUpThisNode();
+		 if ( !mp2[i]->getMemberNode()->bFailed ) {
+			 mp2[i]->logLoadStats();
+		 }
 	}
 
 	return SUCCESS;
@@ -152,7 +167,7 @@ void Application::mp1Run() {
 		/*
 		 * Receive messages from the network and queue them in the membership protocol queue
 		 */
-		if( par->getcurrtime() > (int)(par->STEP_RATE*i) && !(mp1[i]->getMemberNode()->bFailed) ) {
+		if( par->getcurrtime() > startTime(i) && !(mp1[i]->getMemberNode()->bFailed) ) {
 			// Receive messages from the network and queue them
 			mp1[i]->recvLoop();
 		}
@@ -165,7 +180,7 @@ void Application::mp1Run() {
 		/*
 		 * Introduce nodes into the distributed system
 		 */
-		if( par->getcurrtime() == (int)(par->STEP_RATE*i) ) {
+		if( par->getcurrtime() == startTime(i) ) {
 			// introduce the ith node into the system at time STEPRATE*i
 			mp1[i]->nodeStart(JOINADDR, par->PORTNUM);
 			cout<<i<<"-th introduced node is assigned with the address: "<<mp1[i]->getMemberNode()->addr.getAddress() << endl;
@@ -175,7 +190,7 @@ void Application::mp1Run() {
 		/*
 		 * Handle all the messages in your queue and send heartbeats
 		 */
-		else if( par->getcurrtime() > (int)(par->STEP_RATE*i) && !(mp1[i]->getMemberNode()->bFailed) ) {
+		else if( par->getcurrtime() > startTime(i) && !(mp1[i]->getMemberNode()->bFailed) ) {
 			// handle messages and send heartbeats
 			mp1[i]->nodeLoop();
 			#ifdef DEBUGLOG
@@ -186,6 +201,34 @@ void Application::mp1Run() {
 		}
 
 	}
+
+	logConvergence();
+}
+
+/**
+ * FUNCTION NAME: logConvergence
+ *
+ * DESCRIPTION: Log the first time at which every node has joined and every node's
+ * 				membership list holds the whole group. HyParView keeps the whole
+ * 				group in the ring list, as its member list is the active view.
+ */
+void Application::logConvergence() {
+	if ( membershipConverged >= 0 ) {
+		return;
+	}
+	for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+		Member *memberNode = mp1[i]->getMemberNode();
+		if ( !memberNode->inGroup ) {
+			return;
+		}
+		size_t known = par->MEMBERSHIP_MODE == HYPARVIEW_MEMBERSHIP ? memberNode->ringList.size() : memberNode->memberList.size();
+		if ( known != (size_t)par->EN_GPSZ ) {
+			return;
+		}
+	}
+	membershipConverged = par->getcurrtime();
+	log->LOG(&mp1[0]->getMemberNode()->addr, "#STATSLOG# membership converged at %d, %d after the last join",
+			 membershipConverged, membershipConverged - (int)(par->STEP_RATE*(par->EN_GPSZ-1)));
 }
 
 /**
@@ -208,7 +251,7 @@ void Application::mp2Run() {
 		 * 1) Update the ring
 		 * 2) Receive messages from the network and queue them in the KV store queue
 		 */
-		if ( par->getcurrtime() > (int)(par->STEP_RATE*i) && !mp2[i]->getMemberNode()->bFailed ) {
+		if ( par->getcurrtime() > startTime(i) && !mp2[i]->getMemberNode()->bFailed ) {
 			if ( mp2[i]->getMemberNode()->inited && mp2[i]->getMemberNode()->inGroup ) {
 				// Step 1
 				mp2[i]->updateRing();
@@ -222,7 +265,7 @@ void Application::mp2Run() {
 	 * Handle messages from the queue and update the DHT
 	 */
 	for ( i = par->EN_GPSZ-1; i >= 0; i-- ) {
-		if ( par->getcurrtime() > (int)(par->STEP_RATE*i) && !mp2[i]->getMemberNode()->bFailed ) {
+		if ( par->getcurrtime() > startTime(i) && !mp2[i]->getMemberNode()->bFailed ) {
 			mp2[i]->checkMessages();
 		}
 	}
@@ -373,6 +416,21 @@ void Application::fail() {
 
 }
 
+/**
+ * FUNCTION NAME: failNode
+ *
+ * DESCRIPTION: Take a node down. With GRACEFUL_LEAVE the node hands its keys off and
+ * 				announces its departure first, otherwise it simply crashes.
+ */
+void Application::failNode(int i) {
+	if ( par->GRACEFUL_LEAVE ) {
+		mp2[i]->handOffKeys();
+		mp1[i]->leaveGroup();
+	}
+	mp2[i]->getMemberNode()->bFailed = true;
+	mp1[i]->getMemberNode()->bFailed = true;
+}
+
 /**
  * FUNCTION NAME: getjoinaddr
  *
@@ -397,10 +455,23 @@ int Application::findARandomNodeThatIsAlive() {
 	int number;
 	do {
 		number = (rand()%par->EN_GPSZ);
-	}while (mp2[number]->getMemberNode()->bFailed);
+	}while (mp2[number]->getMemberNode()->bFailed || par->getcurrtime() <= startTime(number));
 	return number;
 }
 
+/**
+ * FUNCTION NAME: startTime
+ *
+ * DESCRIPTION: The tick a node starts at. Nodes start STEP_RATE apart, except that the
+ * 				swap scenario holds the last node back to join in place of a failed one.
+ */
+int Application::startTime(int i) {
+	if ( par->SCENARIO == SWAP_SCENARIO && i == par->EN_GPSZ - 1 ) {
+		return SCENARIO_FAULT_TIME + SWAP_JOIN_DELAY;
+	}
+	return (int)(par->STEP_RATE*i);
+}
+
 /**
  * FUNCTION NAME: initTestKVPairs
  *
@@ -553,8 +624,7 @@ void Application::readTest() {
 		}
 		if ( failedOneNode ) {
 			log->LOG(&mp2[nodeToFail]->getMemberNode()->addr, "Node failed at time=%d", par->getcurrtime());
-			mp2[nodeToFail]->getMemberNode()->bFailed = true;
-			mp1[nodeToFail]->getMemberNode()->bFailed = true;
+			failNode(nodeToFail);
 			cout<<endl<<"Failed a replica node"<<endl;
 		}
 		else {
@@ -628,8 +698,7 @@ void Application::readTest() {
                 for ( unsigned int i = 0; i < nodesToFail.size(); i++ ) {
 					// Fail a node
 					log->LOG(&mp2[nodesToFail.at(i)]->getMemberNode()->addr, "Node failed at time=%d", par->getcurrtime());
-					mp2[nodesToFail.at(i)]->getMemberNode()->bFailed = true;
-					mp1[nodesToFail.at(i)]->getMemberNode()->bFailed = true;
+					failNode(nodesToFail.at(i));
 					cout<<endl<<"Failed a replica node"<<endl;
 				}
 			}
@@ -684,8 +753,7 @@ void Application::readTest() {
 					 mp2[i]->getMemberNode()->addr.getAddress() != replicas.at(TERTIARY).getAddress()->getAddress() ) {
 					// Step 4.c Fail a non-replica node
 					log->LOG(&mp2[i]->getMemberNode()->addr, "Node failed at time=%d", par->getcurrtime());
-					mp2[i]->getMemberNode()->bFailed = true;
-					mp1[i]->getMemberNode()->bFailed = true;
+					failNode(i);
 					failedOneNode = true;
 					cout<<endl<<"Failed a non-replica node"<<endl;
 					break;
@@ -800,8 +868,7 @@ void Application::updateTest() {
 		}
 		if ( failedOneNode ) {
 			log->LOG(&mp2[nodeToFail]->getMemberNode()->addr, "Node failed at time=%d", par->getcurrtime());
-			mp2[nodeToFail]->getMemberNode()->bFailed = true;
-			mp1[nodeToFail]->getMemberNode()->bFailed = true;
+			failNode(nodeToFail);
 			cout<<endl<<"Failed a replica node"<<endl;
 		}
 		else {
@@ -872,8 +939,7 @@ void Application::updateTest() {
                 for ( unsigned int i = 0; i < nodesToFail.size(); i++ ) {
 					// Fail a node
 					log->LOG(&mp2[nodesToFail.at(i)]->getMemberNode()->addr, "Node failed at time=%d", par->getcurrtime());
-					mp2[nodesToFail.at(i)]->getMemberNode()->bFailed = true;
-					mp1[nodesToFail.at(i)]->getMemberNode()->bFailed = true;
+					failNode(nodesToFail.at(i));
 					cout<<endl<<"Failed a replica node"<<endl;
 				}
 			}
@@ -926,8 +992,7 @@ void Application::updateTest() {
 					 mp2[i]->getMemberNode()->addr.getAddress() != replicas.at(TERTIARY).getAddress()->getAddress() ) {
 					// Step 4.c Fail a non-replica node
 					log->LOG(&mp2[i]->getMemberNode()->addr, "Node failed at time=%d", par->getcurrtime());
-					mp2[i]->getMemberNode()->bFailed = true;
-					mp1[i]->getMemberNode()->bFailed = true;
+					failNode(i);
 					failedOneNode = true;
 					cout<<endl<<"Failed a non-replica node"<<endl;
 					break;
@@ -973,3 +1038,275 @@ void Application::updateTest() {
 	/** end of test 5 **/
 
 }
+
+/**
+ * FUNCTION NAME: runScenario
+ *
+ * DESCRIPTION: Drive the scenario test picked by SCENARIO, if any. Every scenario ends
+ * 				by checking the copies of the test keys.
+ */
+void Application::runScenario() {
+	switch ( par->SCENARIO ) {
+		case REPAIR_SCENARIO:
+			// anti-entropy must ignore frames it has no ring for, and restore lost copies
+			if ( par->getcurrtime() == 1 ) {
+				sendFramesWithoutRing();
+			}
+			else if ( par->getcurrtime() == SCENARIO_FAULT_TIME ) {
+				dropCopies();
+			}
+			break;
+		case HINT_SCENARIO:
+			// the writes a replica cut off from the KV network misses reach it as hints, but
+			// the writes that failed with two replicas cut off are not hinted
+			if ( par->getcurrtime() == SCENARIO_FAULT_TIME ) {
+				cutOffNodes.push_back(findARandomNodeThatIsAlive());
+				cutOffUntil = SCENARIO_FAULT_TIME + SCENARIO_OUTAGE;
+			}
+			else if ( par->getcurrtime() == SCENARIO_FAULT_TIME + 1 ) {
+				hintedUpdates = updateCutOffKeys("hinted");
+			}
+			else if ( par->getcurrtime() == SCENARIO_FAULT_TIME + 2 * SCENARIO_OUTAGE ) {
+				cutOffCoReplica();
+			}
+			else if ( par->getcurrtime() == SCENARIO_FAULT_TIME + 2 * SCENARIO_OUTAGE + 1 ) {
+				failedUpdates = updateCutOffKeys("");
+			}
+			else if ( par->getcurrtime() == SCENARIO_CHECK_TIME ) {
+				checkHints();
+			}
+			break;
+		case SWAP_SCENARIO:
+			// a node failing and one joining within one settle window still move keys
+			if ( par->getcurrtime() == SCENARIO_FAULT_TIME ) {
+				int number;
+				do {
+					number = findARandomNodeThatIsAlive();
+				} while ( number < par->NUM_INTRODUCERS );
+				log->LOG(&mp2[number]->getMemberNode()->addr, "Node failed at time=%d", par->getcurrtime());
+				failNode(number);
+			}
+			else if ( par->getcurrtime() == startTime(par->EN_GPSZ - 1) + par->RING_SETTLE + SWAP_CHECK_DELAY ) {
+				checkCopies();
+			}
+			break;
+		case ZONE_SCENARIO:
+			// the replicas of every key sit in different zones
+			if ( par->getcurrtime() == SCENARIO_CHECK_TIME ) {
+				checkZones();
+			}
+			break;
+		default:
+			return;
+	}
+	for ( size_t k = 0; k < cutOffNodes.size() && par->getcurrtime() < cutOffUntil; k++ ) {
+		en1->ENrecv(&mp2[cutOffNodes[k]]->getMemberNode()->addr, discardFrame, NULL, 1, NULL);
+	}
+	if ( par->getcurrtime() == SCENARIO_CHECK_TIME ) {
+		checkCopies();
+	}
+}
+
+/**
+ * FUNCTION NAME: discardFrame
+ *
+ * DESCRIPTION: Drop a frame received for a node that is cut off
+ */
+int Application::discardFrame(void *env, char *buff, int size) {
+	free(buff);
+	return 0;
+}
+
+/**
+ * FUNCTION NAME: cutOffCoReplica
+ *
+ * DESCRIPTION: Cut the first cut off node off again, together with a node replicating one
+ * 				of the test keys with it, and count the hints stored so far
+ */
+void Application::cutOffCoReplica() {
+	int number = findARandomNodeThatIsAlive();
+	Address &cutOff = mp2[cutOffNodes[0]]->getMemberNode()->addr;
+	for ( map<string, string>::iterator it = testKVPairs.begin(); it != testKVPairs.end() && cutOffNodes.size() < 2; ++it ) {
+		const vector<Node> &replicas = mp2[number]->findNodes(it->first);
+		for ( size_t k = 0; k < replicas.size(); k++ ) {
+			if ( *replicas[k].getAddress() == cutOff ) {
+				cutOffNodes.push_back(nodeIndex(replicas[(k + 1) % replicas.size()].getAddress()));
+				break;
+			}
+		}
+	}
+	cutOffUntil = par->getcurrtime() + SCENARIO_OUTAGE;
+	hintsStoredBefore = totalHintsStored();
+}
+
+/**
+ * FUNCTION NAME: updateCutOffKeys
+ *
+ * DESCRIPTION: Update every test key all the cut off nodes replicate, through another node,
+ * 				to its value with the given prefix. Returns the keys updated.
+ */
+int Application::updateCutOffKeys(const string &prefix) {
+	int number;
+	do {
+		number = findARandomNodeThatIsAlive();
+	} while ( find(cutOffNodes.begin(), cutOffNodes.end(), number) != cutOffNodes.end() );
+	int updated = 0;
+	for ( map<string, string>::iterator it = testKVPairs.begin(); it != testKVPairs.end(); ++it ) {
+		const vector<Node> &replicas = mp2[number]->findNodes(it->first);
+		size_t cutOff = 0;
+		for ( size_t k = 0; k < replicas.size(); k++ ) {
+			cutOff += find(cutOffNodes.begin(), cutOffNodes.end(), nodeIndex(replicas[k].getAddress())) != cutOffNodes.end();
+		}
+		if ( cutOff == cutOffNodes.size() ) {
+			it->second = prefix + it->second;
+			log->LOG(&mp2[number]->getMemberNode()->addr, "UPDATE OPERATION KEY: %s VALUE: %s at time: %d", it->first.c_str(), it->second.c_str(), par->getcurrtime());
+			mp2[number]->clientUpdate(it->first, it->second);
+			updated++;
+		}
+	}
+	log->LOG(&mp2[cutOffNodes[0]]->getMemberNode()->addr, "SCENARIO %lu nodes cut off until %d, %d keys updated without them",
+			 (unsigned long)cutOffNodes.size(), cutOffUntil, updated);
+	return updated;
+}
+
+/**
+ * FUNCTION NAME: totalHintsStored
+ *
+ * DESCRIPTION: The hints stored by all the nodes so far
+ */
+long Application::totalHintsStored() {
+	long stored = 0;
+	for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+		stored += mp2[i]->getHintsStored();
+	}
+	return stored;
+}
+
+/**
+ * FUNCTION NAME: checkHints
+ *
+ * DESCRIPTION: Check that every update the first cut off node missed alone was delivered to
+ * 				it as a hint, and that the updates that failed while two replicas were cut
+ * 				off stored no hints. Those rewrite the keys' values, so the copies of the
+ * 				test keys hold the same values whether or not they were replayed.
+ */
+void Application::checkHints() {
+	long delivered = 0;
+	for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+		delivered += mp2[i]->getHintsDelivered();
+	}
+	long failedHints = totalHintsStored() - hintsStoredBefore;
+	bool passed = hintedUpdates > 0 && delivered >= hintedUpdates && failedUpdates > 0 && failedHints == 0;
+	log->LOG(&mp2[cutOffNodes[0]]->getMemberNode()->addr, "SCENARIO %s: %ld hints delivered for %d updates missed, %ld hints stored for %d failed updates",
+			 passed ? "PASS" : "FAIL", delivered, hintedUpdates, failedHints, failedUpdates);
+}
+
+/**
+ * FUNCTION NAME: sendFramesWithoutRing
+ *
+ * DESCRIPTION: Hand the first node, whose ring is still empty, a MERKLE_WANT and a REPAIR
+ * 				frame from the second. Both must be ignored.
+ */
+void Application::sendFramesWithoutRing() {
+	Address &from = mp2[1]->getMemberNode()->addr;
+	vector<pair<string, string> > wants;
+	vector<pair<string, string> > records;
+	wants.push_back(make_pair("scenarioKey", ""));
+	records.push_back(make_pair("scenarioKey", "1:L:scenarioValue"));
+	Message want(0, from, MERKLE, MERKLE_WANT, wants);
+	Message repair(0, from, REPAIR, 0, records);
+	mp2[0]->merkleMessageHandler(Message(want.toString()));
+	mp2[0]->repairMessageHandler(Message(repair.toString()));
+	bool ignored = !mp2[0]->holdsRecord("scenarioKey");
+	log->LOG(&mp2[0]->getMemberNode()->addr, "SCENARIO %s: frames to a node without a ring ignored", ignored ? "PASS" : "FAIL");
+}
+
+/**
+ * FUNCTION NAME: dropCopies
+ *
+ * DESCRIPTION: Lose one copy of every test key, taking the replicas in turn, as if the
+ * 				write had never reached it
+ */
+void Application::dropCopies() {
+	int number = findARandomNodeThatIsAlive();
+	size_t k = 0;
+	for ( map<string, string>::iterator it = testKVPairs.begin(); it != testKVPairs.end(); ++it, ++k ) {
+		const vector<Node> &replicas = mp2[number]->findNodes(it->first);
+		if ( !replicas.empty() ) {
+			mp2[nodeIndex(replicas[k % replicas.size()].getAddress())]->forgetKey(it->first);
+		}
+	}
+	log->LOG(&mp2[number]->getMemberNode()->addr, "SCENARIO dropped one copy of %lu keys", (unsigned long)testKVPairs.size());
+}
+
+/**
+ * FUNCTION NAME: checkCopies
+ *
+ * DESCRIPTION: Check that every replica of every test key, as a live node places them,
+ * 				holds the key's latest value
+ */
+void Application::checkCopies() {
+	int number = findARandomNodeThatIsAlive();
+	int missing = 0;
+	for ( map<string, string>::iterator it = testKVPairs.begin(); it != testKVPairs.end(); ++it ) {
+		const vector<Node> &replicas = mp2[number]->findNodes(it->first);
+		missing += RF - min((int)replicas.size(), RF);
+		for ( size_t k = 0; k < replicas.size(); k++ ) {
+			if ( !holdsValue(nodeIndex(replicas[k].getAddress()), it->first, it->second) ) {
+				missing++;
+			}
+		}
+	}
+	log->LOG(&mp2[number]->getMemberNode()->addr, "SCENARIO %s: %d of %lu copies of the test keys missing",
+			 missing == 0 ? "PASS" : "FAIL", missing, (unsigned long)(RF * testKVPairs.size()));
+}
+
+/**
+ * FUNCTION NAME: checkZones
+ *
+ * DESCRIPTION: Check that the replicas of every test key, as every live node places them,
+ * 				sit in as many different zones as there are, up to RF
+ */
+void Application::checkZones() {
+	int wanted = min(par->NUM_ZONES, RF);
+	int crowded = 0;
+	for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+		if ( mp2[i]->getMemberNode()->bFailed ) {
+			continue;
+		}
+		for ( map<string, string>::iterator it = testKVPairs.begin(); it != testKVPairs.end(); ++it ) {
+			const vector<Node> &replicas = mp2[i]->findNodes(it->first);
+			set<int> zones;
+			for ( size_t k = 0; k < replicas.size(); k++ ) {
+				zones.insert(replicas[k].getAddress()->getZone(par->NUM_ZONES));
+			}
+			if ( (int)zones.size() < wanted ) {
+				crowded++;
+			}
+		}
+	}
+	log->LOG(&mp2[0]->getMemberNode()->addr, "SCENARIO %s: %d replica sets of the test keys in fewer than %d zones",
+			 crowded == 0 ? "PASS" : "FAIL", crowded, wanted);
+}
+
+/**
+ * FUNCTION NAME: nodeIndex
+ *
+ * DESCRIPTION: The index of the node at an address, which is one less than its id
+ */
+int Application::nodeIndex(const Address *addr) {
+	return *(const int *)(&(addr->addr)) - 1;
+}
+
+/**
+ * FUNCTION NAME: holdsValue
+ *
+ * DESCRIPTION: Whether a live node holds a key with the given value
+ */
+bool Application::holdsValue(int i, const string &key, const string &value) {
+	if ( mp2[i]->getMemberNode()->bFailed || !mp2[i]->holdsRecord(key) ) {
+		return false;
+	}
+	string record = mp2[i]->encodeRecord(key);
+	return record.compare(record.find(':'), string::npos, ":L:" + value) == 0;
+}
@@ -41,6 +41,17 @@ static const char alphanum[] =
 #define NUMBER_OF_INSERTS 100
 #define KEY_LENGTH 5
 
+/*
+ * Scenario macros. The scenario picked by SCENARIO injects its faults from
+ * SCENARIO_FAULT_TIME on, and the copies of the test keys are checked at
+ * SCENARIO_CHECK_TIME
+ */
+#define SCENARIO_FAULT_TIME (INSERT_TIME+20)
+#define SCENARIO_CHECK_TIME (TOTAL_RUNNING_TIME-1)
+#define SCENARIO_OUTAGE 15
+#define SWAP_JOIN_DELAY 20
+#define SWAP_CHECK_DELAY 10
+
 /**
  * CLASS NAME: Application
  *
@@ -58,6 +69,16 @@ private:
 	MP2Node **mp2;
 	Params *par;
 	map<string, string> testKVPairs;
+	// time every node first had the whole group in its membership list, -1 until then
+	int membershipConverged;
+	// nodes whose KV frames a scenario drops until cutOffUntil, the updates the first of
+	// them missed alone, the updates that failed with two of them cut off, and the hints
+	// stored before those
+	vector<int> cutOffNodes;
+	int cutOffUntil;
+	int hintedUpdates;
+	int failedUpdates;
+	long hintsStoredBefore;
 public:
 	Application(char *);
 	virtual ~Application();
@@ -66,12 +87,27 @@ public:
 	int run();
 	void mp1Run();
 	void mp2Run();
+	void logConvergence();
 	void fail();
+	void failNode(int i);
 	void insertTestKVPairs();
 	int findARandomNodeThatIsAlive();
+	int startTime(int i);
 	void deleteTest();
 	void readTest();
 	void updateTest();
+	void runScenario();
+	void sendFramesWithoutRing();
+	void dropCopies();
+	void checkCopies();
+	static int discardFrame(void *env, char *buff, int size);
+	void cutOffCoReplica();
+	int updateCutOffKeys(const string &prefix);
+	long totalHintsStored();
+	void checkHints();
+	void checkZones();
+	int nodeIndex(const Address *addr);
+	bool holdsValue(int i, const string &key, const string &value);
 };
 
 #endif /* _APPLICATION_H__ */
@@ -23,6 +23,10 @@ EmulNet::EmulNet(Params *p)
 			recv_msgs[i][j] = 0;
 		}
 	}
+	for ( i = 0; i <= MAX_NODES; i++ ) {
+		sent_bytes[i] = 0;
+		recv_bytes[i] = 0;
+	}
 	//trace.funcExit("EmulNet::EmulNet", SUCCESS);
 }
 
@@ -39,6 +43,10 @@ EmulNet::EmulNet(EmulNet &anotherEmulNet) {
 			this->recv_msgs[i][j] = anotherEmulNet.recv_msgs[i][j];
 		}
 	}
+	for ( i = 0; i <= MAX_NODES; i++ ) {
+		this->sent_bytes[i] = anotherEmulNet.sent_bytes[i];
+		this->recv_bytes[i] = anotherEmulNet.recv_bytes[i];
+	}
 	this->emulnet = anotherEmulNet.emulnet;
 }
 
@@ -55,6 +63,10 @@ EmulNet& EmulNet::operator =(EmulNet &anotherEmulNet) {
 			this->recv_msgs[i][j] = anotherEmulNet.recv_msgs[i][j];
 		}
 	}
+	for ( i = 0; i <= MAX_NODES; i++ ) {
+		this->sent_bytes[i] = anotherEmulNet.sent_bytes[i];
+		this->recv_bytes[i] = anotherEmulNet.recv_bytes[i];
+	}
 	this->emulnet = anotherEmulNet.emulnet;
 	return *this;
 }
@@ -99,6 +111,11 @@ int EmulNet::ENsend(Address *myaddr, Address *toaddr, char *data, int size) {
 	memcpy(&(em->from.addr), &(myaddr->addr), sizeof(em->from.addr));
 	memcpy(&(em->to.addr), &(toaddr->addr), sizeof(em->from.addr));
 	memcpy(em + 1, data, size);
+	// a message is received the tick after it is sent, later if it crosses zones
+	em->deliverAt = par->getcurrtime() + 1;
+	if ( myaddr->getZone(par->NUM_ZONES) != toaddr->getZone(par->NUM_ZONES) ) {
+		em->deliverAt += par->ZONE_LATENCY;
+	}
 
 	emulnet.buff[emulnet.currbuffsize++] = em;
 
@@ -109,6 +126,7 @@ int EmulNet::ENsend(Address *myaddr, Address *toaddr, char *data, int size) {
 	assert(time < MAX_TIME);
 
 	sent_msgs[src][time]++;
+	sent_bytes[src] += size;
 
 	#ifdef DEBUGLOG
 		sprintf(temp, "Sending 4+%d B msg type %d to %d.%d.%d.%d:%d ", size-4, *(int *)data, toaddr->addr[0], toaddr->addr[1], toaddr->addr[2], toaddr->addr[3], *(short *)&toaddr->addr[4]);
@@ -151,7 +169,8 @@ int EmulNet::ENrecv(Address *myaddr, int (* enq)(void *, char *, int), struct ti
 	for( i = emulnet.currbuffsize - 1; i >= 0; i-- ) {
 		emsg = emulnet.buff[i];
 
-		if ( 0 == strcmp(emsg->to.addr, myaddr->addr) ) {
+		// addresses are raw 6-byte ids that may contain zero bytes
+		if ( 0 == memcmp(emsg->to.addr, myaddr->addr, sizeof(myaddr->addr)) && emsg->deliverAt <= par->getcurrtime() ) {
 			sz = emsg->size;
 			tmp = (char *) malloc(sz * sizeof(char));
 			memcpy(tmp, (char *)(emsg+1), sz);
@@ -170,6 +189,7 @@ int EmulNet::ENrecv(Address *myaddr, int (* enq)(void *, char *, int), struct ti
 			assert(time < MAX_TIME);
 
 			recv_msgs[dst][time]++;
+			recv_bytes[dst] += sz;
 		}
 	}
 
@@ -185,6 +205,7 @@ int EmulNet::ENcleanup() {
 	emulnet.nextid=0;
 	int i, j;
 	int sent_total, recv_total;
+	long sent_bytes_total = 0, recv_bytes_total = 0;
 
 	FILE* file = fopen("msgcount.log", "w+");
 
@@ -213,7 +234,11 @@ int EmulNet::ENcleanup() {
 		}
 		fprintf(file, "\n");
 		fprintf(file, "node %3d sent_total %6u  recv_total %6u\n\n", i, sent_total, recv_total);
+		fprintf(file, "node %3d sent_bytes %8ld  recv_bytes %8ld\n\n", i, sent_bytes[i], recv_bytes[i]);
+		sent_bytes_total += sent_bytes[i];
+		recv_bytes_total += recv_bytes[i];
 	}
+	fprintf(file, "all nodes sent_bytes %ld  recv_bytes %ld\n", sent_bytes_total, recv_bytes_total);
 
 	fclose(file);
 	return 0;
@@ -27,6 +27,8 @@ typedef struct en_msg {
 	Address from;
 	// Destination node
 	Address to;
+	// First tick the message can be received
+	int deliverAt;
 }en_msg;
 
 /**
@@ -82,6 +84,8 @@ private:
 	Params* par;
 	int sent_msgs[MAX_NODES + 1][MAX_TIME];
 	int recv_msgs[MAX_NODES + 1][MAX_TIME];
+	long sent_bytes[MAX_NODES + 1];
+	long recv_bytes[MAX_NODES + 1];
 	int enInited;
 	EM emulnet;
 public:
@@ -62,6 +62,23 @@ bool MP1Node::recvCallBack(void *envelope, char *data, int size ) {
 
     MembershipMessage * message = (MembershipMessage *) data;
 
+    //drop frames too short for the entries they claim to carry
+    if (size < (int)sizeof(MembershipMessage)
+        || size < (int)(sizeof(MembershipMessage) + message->entryCount * sizeof(GossipEntry))) {
+        log->LOG(&memberNode->addr, "Received truncated msg");
+        return 0;
+    }
+
+    if (par->MEMBERSHIP_MODE == HYPARVIEW_MEMBERSHIP) {
+        //any frame from an active neighbour shows that it is alive
+        int peer = findMember(getAddressId(message->address), getAddressPort(message->address));
+        if (peer >= 0) {
+            memberNode->memberList.settimestamp(peer, par->getcurrtime());
+        }
+        //and any frame from a suspect shows that only the link failed
+        suspects.erase(memberKey(getAddressId(message->address), getAddressPort(message->address)));
+    }
+
     switch (message->messageType) {
     case JOINREQ:
         handleJoinRequest(message);
@@ -72,6 +89,42 @@ bool MP1Node::recvCallBack(void *envelope, char *data, int size ) {
     case MEMBER_TABLE:
         handleMemberTable(message);
         break;
+    case PING:
+        handlePing(message);
+        break;
+    case ACK:
+        handleAck(message);
+        break;
+    case PING_REQ:
+        handlePingReq(message);
+        break;
+    case FORWARD_JOIN:
+        handleForwardJoin(message);
+        break;
+    case NEIGHBOR:
+        handleNeighbor(message);
+        break;
+    case NEIGHBOR_REPLY:
+        handleNeighborReply(message);
+        break;
+    case DISCONNECT:
+        handleDisconnect(message);
+        break;
+    case SHUFFLE:
+        handleShuffle(message);
+        break;
+    case SHUFFLE_REPLY:
+        handleShuffleReply(message);
+        break;
+    case KEEPALIVE:
+        handleKeepalive(message);
+        break;
+    case RING_UPDATE:
+        handleRingUpdate(message);
+        break;
+    case LEAVE:
+        handleLeave(message);
+        break;
     default:
         log->LOG(&memberNode->addr, "Received other msg");
         break;
@@ -88,30 +141,33 @@ bool MP1Node::recvCallBack(void *envelope, char *data, int size ) {
  */
 void MP1Node::nodeLoopOps() {
 
-    // set timeout value
-    int timeout = TREMOVE;
+    if (par->MEMBERSHIP_MODE == SWIM_MEMBERSHIP) {
+        swimLoopOps();
+        return;
+    }
+    if (par->MEMBERSHIP_MODE == HYPARVIEW_MEMBERSHIP) {
+        hpvLoopOps();
+        return;
+    }
 
     //increment heartbeat
     memberNode->heartbeat += 1;
 
 
 
-    //check for failed nodes and delete them
-    for (vector<MemberListEntry>::iterator it = memberNode->memberList.begin();
-         it != memberNode->memberList.end();) {
-        // compare duration since last timestamp and timeout value
-        if (par->getcurrtime() - it->timestamp > timeout) {
-            Address addr = makeAddress(it->id, it->port);
-            log->logNodeRemove(&memberNode->addr, &addr);
-            memberNode->memberList.erase(it);
-            if (getMyId() == 10) {
-                //cout << "timing out node " << addr.getAddress() << " from " << memberNode->addr.getAddress() << endl;
-                logMemberStatus();
+    //check for failed nodes and delete them. The timeout detector takes them off the
+    //front of the table's update order, phi has to be worked out for every member
+    vector<size_t> expired;
+    if (par->FAILURE_DETECTOR == PHI_ACCRUAL_DETECTOR) {
+        for (size_t i = 0; i < memberNode->memberList.size(); i++) {
+            if (hasFailed(i)) {
+                expired.push_back(i);
             }
-        } else {
-            it++;
         }
+    } else {
+        memberNode->memberList.collectStale(par->getcurrtime() - TREMOVE - 1, expired);
     }
+    removeExpired(expired);
 
 
     //now update informatino for this node
@@ -130,9 +186,34 @@ void MP1Node::nodeLoopOps() {
  * DESCRIPTION: Wind up this node and clean up state
  */
 int MP1Node::finishUpThisNode(){
-    /*
-    * Your code goes here
-    */
+    logGossipStats();
+    return 0;
+}
+
+/**
+ * FUNCTION NAME: leaveGroup
+ *
+ * DESCRIPTION: Announce a planned departure, so the group removes this node at once
+ *              instead of waiting for its failure detector. The full view modes tell
+ *              every member directly, HyParView tells its neighbours and they flood it
+ *              over the ring. The keys should be handed off by MP2Node first.
+ */
+int MP1Node::leaveGroup() {
+    GossipEntry myEntry;
+    myEntry.id = getMyId();
+    myEntry.port = getMyPort();
+    myEntry.state = MEMBER_DEPARTED;
+    myEntry.heartbeat = memberNode->heartbeat;
+    vector<GossipEntry> entries(1, myEntry);
+
+    for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+        MemberListEntry member = memberNode->memberList.at(i);
+        if (member.getid() != getMyId() || member.getport() != getMyPort()) {
+            Address destination = makeAddress(member.getid(), member.getport());
+            sendGossipEntries(&destination, LEAVE, entries);
+        }
+    }
+    memberNode->inGroup = false;
     return 0;
 }
 
@@ -160,6 +241,22 @@ MP1Node::MP1Node(Member *member, Params *params, EmulNet *emul, Log *log, Addres
     this->log = log;
     this->par = params;
     this->memberNode->addr = *address;
+    this->gossipFramesSent = 0;
+    this->gossipEntriesSent = 0;
+    this->gossipBytesSent = 0;
+    this->probeIndex = 0;
+    this->probeKey = -1;
+    this->probeStart = 0;
+    this->probeAcked = false;
+    this->pingReqSent = false;
+    this->nextProbeTime = 0;
+    this->ringChanged = false;
+    this->pendingNeighbor = -1;
+    this->neighborStart = 0;
+    this->nextShuffleTime = 0;
+    this->nextRingSyncTime = 0;
+    this->joinAttempts = 0;
+    this->joinStart = 0;
 }
 
 /**
@@ -201,7 +298,7 @@ int MP1Node::enqueueWrapper(void *env, char *buff, int size) {
  */
 void MP1Node::nodeStart(char *servaddrstr, short servport) {
     Address joinaddr;
-    joinaddr = getJoinAddress();
+    joinaddr = getIntroducerAddress(0);
 
     //cout << "nodeStart: " << this->memberNode->addr.getAddress() << " joinaddr=" << joinaddr.getAddress() << endl;
 
@@ -264,17 +361,22 @@ int MP1Node::introduceSelfToGroup(Address *newNodeAddress) {
         msg->address = memberNode->addr;
         ////cout << "introduceSelfToGroup:member address is " << memberNode->addr.getAddress() << endl;
         msg->heartbeat = memberNode->heartbeat;
+        msg->target.init();
+        msg->param = 0;
+        msg->entryCount = 0;
 
 #ifdef DEBUGLOG
         sprintf(s, "Trying to join...");
         log->LOG(&memberNode->addr, s);
 #endif
 
+        joinStart = par->getcurrtime();
+
         // send JOINREQ message to introducer member
         //cout << "introduceSelfToGroup:sending Join Mesage from " << memberNode->addr.getAddress() << endl;
         emulNet->ENsend(&memberNode->addr, newNodeAddress, (char *)msg, msgsize);
 
-        free(msg);
+        delete msg;
     }
 
     return 1;
@@ -300,6 +402,12 @@ void MP1Node::nodeLoop() {
 
     // Wait until you're in the group...
     if( !memberNode->inGroup ) {
+        //no reply yet, the introducer may be down so ask the next one
+        if (par->getcurrtime() - joinStart >= JOIN_RETRY_TIMEOUT) {
+            joinAttempts++;
+            Address joinAddress = getIntroducerAddress(joinAttempts);
+            introduceSelfToGroup(&joinAddress);
+        }
         return;
     }
 
@@ -324,7 +432,17 @@ void MP1Node::checkMessages() {
         size = memberNode->mp1q.front().size;
         memberNode->mp1q.pop();
         recvCallBack((void *)memberNode, (char *)ptr, size);
+        free(ptr);
     }
+
+    //membership digests that came in on KV messages count like gossip
+    for (size_t i = 0; i < memberNode->kvDigests.size(); i++) {
+        Address &entry = memberNode->kvDigests[i].first;
+        updateMemberList(getAddressId(entry), getAddressPort(entry), memberNode->kvDigests[i].second);
+    }
+    memberNode->kvDigests.clear();
+    //keep the ring list in step with the membership version MP2Node reads
+    updateRingList();
     return;
 }
 
@@ -353,6 +471,24 @@ Address MP1Node::getJoinAddress() {
     return joinaddr;
 }
 
+/**
+ * FUNCTION NAME: getIntroducerAddress
+ *
+ * DESCRIPTION: Returns the introducer to send a join request to. The first NUM_INTRODUCERS
+ *              nodes share the introducer duties and each joiner picks one of those started
+ *              before it by its id, moving on to the next one on every retry. The first node
+ *              gets its own address and boots the group.
+ */
+Address MP1Node::getIntroducerAddress(int attempt) {
+    int introducers = min(par->NUM_INTRODUCERS, getMyId() - 1);
+    if (introducers <= 0) {
+        return getJoinAddress();
+    }
+    Address joinaddr = getJoinAddress();
+    *(int *)(&joinaddr.addr) = (getMyId() + attempt) % introducers + 1;
+    return joinaddr;
+}
+
 /**
  * FUNCTION NAME: initMemberListTable
  *
@@ -362,23 +498,33 @@ Address MP1Node::getJoinAddress() {
 void MP1Node::initMemberListTable(Member *memberNode, int id, short port) {
     memberNode->memberList.clear();
 
-    //add join address
-    MemberListEntry joinNode = MemberListEntry(id, port);
-    joinNode.settimestamp(par->getcurrtime());
-    joinNode.setheartbeat(memberNode->heartbeat);
-    memberNode->memberList.push_back(joinNode);
+    if (par->MEMBERSHIP_MODE == HYPARVIEW_MEMBERSHIP) {
+        //the active view fills up while joining, the ring starts out with this node alone
+        GossipEntry myEntry;
+        myEntry.id = getMyId();
+        myEntry.port = getMyPort();
+        myEntry.state = MEMBER_ALIVE;
+        myEntry.heartbeat = memberNode->heartbeat;
+        applyRingEntry(myEntry);
+        updateRingList();
+        return;
+    }
+
+    //add join address, unless this node is the one booting the group
     Address coordinator = makeAddress(id, port);
+    Address myAddress = memberNode->addr;
+    if (!(coordinator == myAddress)) {
+        memberNode->memberList.insert(id, port, memberNode->heartbeat, par->getcurrtime());
+        memberNode->addMembershipEvent(MEMBER_JOINED, coordinator);
+    }
 
 
     //add yourself to the list
-    MemberListEntry myNode = MemberListEntry(getMyId(), getMyPort());
-    myNode.settimestamp(par->getcurrtime());
-    myNode.setheartbeat(memberNode->heartbeat);
-    memberNode->memberList.push_back(myNode);
-    Address myAddress = memberNode->addr;
+    memberNode->memberList.insert(getMyId(), getMyPort(), memberNode->heartbeat, par->getcurrtime());
 
     //need to log the home address as joined
     log->logNodeAdd(&myAddress,&coordinator);
+    memberNode->addMembershipEvent(MEMBER_JOINED, myAddress);
 
 }
 
@@ -386,27 +532,76 @@ void MP1Node::initMemberListTable(Member *memberNode, int id, short port) {
 
 void MP1Node::handleJoinRequest(MembershipMessage  *mRequest) {
 
-    //create a join reply and send it
-    MembershipMessage  *mReply;
-    mReply = new MembershipMessage ;
-    size_t msgsize = sizeof(MembershipMessage);
+    //an introducer still joining itself passes the request on to the group booter,
+    //which replies to the joiner straight away
+    Address joinAddress = getJoinAddress();
+    if (!memberNode->inGroup && !(joinAddress == memberNode->addr)) {
+        emulNet->ENsend(&memberNode->addr, &joinAddress, (char *)mRequest, sizeof(MembershipMessage));
+        return;
+    }
+
+    if (par->MEMBERSHIP_MODE == SWIM_MEMBERSHIP) {
+        int id = getAddressId(mRequest->address);
+        short port = getAddressPort(mRequest->address);
+        updateMemberList(id, port, mRequest->heartbeat);
+        queueSwimUpdate(id, port, mRequest->heartbeat, MEMBER_ALIVE);
+
+        //SWIM only disseminates changes, so the joiner gets the whole list up front
+        vector<GossipEntry> entries;
+        for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+            GossipEntry entry;
+            entry.id = memberNode->memberList.getid(i);
+            entry.port = memberNode->memberList.getport(i);
+            entry.state = MEMBER_ALIVE;
+            entry.heartbeat = memberNode->memberList.getheartbeat(i);
+            entries.push_back(entry);
+        }
+        sendGossipEntries(&mRequest->address, JOINREP, entries);
+        return;
+    }
 
+    if (par->MEMBERSHIP_MODE == HYPARVIEW_MEMBERSHIP) {
+        int id = getAddressId(mRequest->address);
+        short port = getAddressPort(mRequest->address);
+        long key = memberKey(id, port);
+        addActive(id, port);
+
+        //the joiner gets the ring up front, its active view grows from random walks
+        vector<GossipEntry> entries;
+        collectRingEntries(entries);
+        sendGossipEntries(&mRequest->address, JOINREP, entries);
+        for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+            MemberListEntry peer = memberNode->memberList.at(i);
+            if (memberKey(peer.getid(), peer.getport()) != key) {
+                Address destination = makeAddress(peer.getid(), peer.getport());
+                vector<GossipEntry> none;
+                sendGossipEntries(&destination, FORWARD_JOIN, none, &mRequest->address, HPV_ACTIVE_RWL);
+            }
+        }
 
-    mReply->messageType = JOINREP;
-    mReply->heartbeat = memberNode->heartbeat;
-    mReply->address=mRequest->address;
+        GossipEntry joiner;
+        joiner.id = id;
+        joiner.port = port;
+        joiner.state = MEMBER_ALIVE;
+        joiner.heartbeat = mRequest->heartbeat;
+        if (applyRingEntry(joiner)) {
+            vector<GossipEntry> changed(1, joiner);
+            floodRing(changed, key);
+        }
+        return;
+    }
 
-    updateMemberList(getAddressId(mReply->address), getAddressPort(mReply->address), mReply->heartbeat);
+    int id = getAddressId(mRequest->address);
+    short port = getAddressPort(mRequest->address);
+    updateMemberList(id, port, mRequest->heartbeat);
 
     logMemberStatus();
 
-    //cout << "handleJoinrequest:Sending JOINREP from ";
-    //cout << mRequest->address.getAddress();
-    //cout << "to " << memberNode->addr.getAddress();
-    //cout << ":heartbeat=" << memberNode->heartbeat << endl;
-
-    emulNet->ENsend(&memberNode->addr, &(mReply->address), (char *)mReply, msgsize);
-    free(mReply);
+    //the join reply carries every live member, so the joiner has a full view after one
+    //round trip; this also counts as a full sync to it for delta gossip
+    vector<GossipEntry> entries;
+    collectGossipEntries(memberKey(id, port), entries);
+    sendGossipEntries(&mRequest->address, JOINREP, entries);
 }
 
 void MP1Node::handleJoinReply(MembershipMessage *message) {
@@ -414,12 +609,28 @@ void MP1Node::handleJoinReply(MembershipMessage *message) {
     //got a reply so we are in the group now
     memberNode->inGroup = true;
 
+    if (par->MEMBERSHIP_MODE == HYPARVIEW_MEMBERSHIP) {
+        //the introducer becomes the first neighbour and sends its ring state along
+        addActive(getAddressId(message->address), getAddressPort(message->address));
+        GossipEntry *entries = (GossipEntry *)(message + 1);
+        for (int i = 0; i < message->entryCount; i++) {
+            applyRingEntry(entries[i]);
+        }
+        return;
+    }
+
     // update the heartbeat and the member table
     Address sender = message->address;
     int id = getAddressId(sender);
     short port = getAddressPort(sender);
     updateMemberList(id, port, message->heartbeat);
     //cout << "handleJoinReply: reply from " << sender.getAddress() << endl;
+
+    //the introducer may send its member list along
+    GossipEntry *entries = (GossipEntry *)(message + 1);
+    for (int i = 0; i < message->entryCount; i++) {
+        updateMemberList(entries[i].id, entries[i].port, entries[i].heartbeat);
+    }
 }
 
 
@@ -431,42 +642,91 @@ void MP1Node::handleMemberTable(MembershipMessage *message) {
     }
 
 
-    vector<MemberListEntry>::iterator mlItem = message->memberList.begin();
-    for (; mlItem != message->memberList.end(); ++mlItem) {
-        int id = mlItem->getid();
-        short port = mlItem->getport();
-        long heartbeat = mlItem->getheartbeat();
-        updateMemberList(id, port, heartbeat);
+    //the entries are packed straight after the header
+    GossipEntry *entries = (GossipEntry *)(message + 1);
+    for (int i = 0; i < message->entryCount; i++) {
+        updateMemberList(entries[i].id, entries[i].port, entries[i].heartbeat);
+    }
+
+    //a push-pull round: answer once per tick with what the sender has not been told yet
+    if (message->param == 1) {
+        long senderKey = memberKey(getAddressId(message->address), getAddressPort(message->address));
+        GossipPeer &peer = gossipPeers[senderKey];
+        if (peer.lastPulled != par->getcurrtime()) {
+            peer.lastPulled = par->getcurrtime();
+            vector<GossipEntry> reply;
+            collectGossipEntries(senderKey, reply);
+            sendGossipEntries(&message->address, MEMBER_TABLE, reply);
+        }
     }
 
     ////cout << "handleMemberTable from " << message->address.getAddress() << endl;
 }
 
+/**
+ * FUNCTION NAME: handleLeave
+ *
+ * DESCRIPTION: Remove a member that announced its departure and pass the news on
+ */
+void MP1Node::handleLeave(MembershipMessage *message) {
+    GossipEntry *entries = (GossipEntry *)(message + 1);
+    if (message->entryCount < 1) {
+        return;
+    }
+    GossipEntry entry = entries[0];
+    long key = memberKey(entry.id, entry.port);
+
+    if (par->MEMBERSHIP_MODE == SWIM_MEMBERSHIP) {
+        if (findMember(entry.id, entry.port) >= 0) {
+            confirmMember(entry.id, entry.port, entry.heartbeat, MEMBER_DEPARTED);
+        }
+    } else if (par->MEMBERSHIP_MODE == HYPARVIEW_MEMBERSHIP) {
+        removeActive(entry.id, entry.port);
+        removePassive(key);
+        if (applyRingEntry(entry)) {
+            vector<GossipEntry> changed(1, entry);
+            floodRing(changed, key);
+        }
+    } else {
+        departedMembers[key] = entry.heartbeat;
+        detector.remove(key);
+        gossipPeers.erase(key);
+        removeMember(entry.id, entry.port, true);
+    }
+}
+
 void MP1Node::updateMemberList(int id, short port, long heartbeat)  {
 
     //given a new node with id, port, and heartbeat, add it to the member list
 
     //if the node exists then update it
-    //loop through the list and find
-    vector<MemberListEntry>::iterator it = memberNode->memberList.begin();
-
-    for (; it != memberNode->memberList.end(); ++it) {
-        if (it->id == id && it->port ==port) {
-            if (heartbeat > it->heartbeat) {
-                it->setheartbeat(heartbeat);
-                it->settimestamp(par->getcurrtime());
-            }
-            ////cout << "updatememberlist: updating " << id << ":" << port << ":" << heartbeat << endl;
+    int found = memberNode->memberList.find(id, port);
+    if (found >= 0) {
+        if (heartbeat > memberNode->memberList.getheartbeat(found)) {
+            memberNode->memberList.setheartbeat(found, heartbeat);
+            memberNode->memberList.settimestamp(found, par->getcurrtime());
+            detector.heartbeat(memberKey(id, port), par->getcurrtime());
+        }
+        ////cout << "updatememberlist: updating " << id << ":" << port << ":" << heartbeat << endl;
+        return;
+    }
+
+    //a member that left only comes back with a newer heartbeat
+    map<long, long>::iterator departed = departedMembers.find(memberKey(id, port));
+    if (departed != departedMembers.end()) {
+        if (heartbeat <= departed->second) {
             return;
         }
+        departedMembers.erase(departed);
     }
 
     //item not found in list, so add it.
-    MemberListEntry memberEntry(id, port, heartbeat, par->getcurrtime());
-    memberNode->memberList.push_back(memberEntry);
+    memberNode->memberList.insert(id, port, heartbeat, par->getcurrtime());
+    detector.heartbeat(memberKey(id, port), par->getcurrtime());
 
     Address newMember = makeAddress(id, port);
     log->logNodeAdd(&memberNode->addr, &newMember);
+    memberNode->addMembershipEvent(MEMBER_JOINED, newMember);
     if (getMyId() == 10) {
         //cout << "updatememberlist: adding " << id << ":" << port << ":" << heartbeat << endl;
     }
@@ -479,57 +739,1060 @@ void MP1Node::updateMemberList(int id, short port, long heartbeat)  {
 
 void MP1Node::sendMemberTables()
 {
-    int sendCount = SPREAD_RATE;
     int listSize = memberNode->memberList.size();
 
-    if (sendCount > listSize) {
-        sendCount = listSize;
+    //this node's own entry is never a gossip target
+    int selfIndex = findMember(getMyId(), getMyPort());
+    int candidates = listSize;
+    if (selfIndex >= 0) {
+        candidates--;
+    } else {
+        selfIndex = listSize;
     }
 
-    MembershipMessage *message;
-    message = new MembershipMessage;
+    int sendCount = gossipFanout(candidates + 1);
+    //peers that got a digest on KV traffic since the last round stand in for gossip frames
+    if (par->PIGGYBACK_GOSSIP) {
+        sendCount = max(sendCount - memberNode->kvDigestPeers, 1);
+        memberNode->kvDigestPeers = 0;
+    }
+    if (sendCount > candidates) {
+        sendCount = candidates;
+    }
 
-    message->messageType = MEMBER_TABLE;
+    //Floyd's sampling picks sendCount distinct positions without reordering memberList
+    set<int> picked;
+    for (int j = candidates - sendCount; j < candidates; j++) {
+        int r = rand() % (j + 1);
+        picked.insert(picked.count(r) ? j : r);
+    }
 
-    //copy the address - the sent message gets assigned the FROM address
-    message->address = memberNode->addr;
+    for (set<int>::iterator it = picked.begin(); it != picked.end(); it++) {
+        int index = *it >= selfIndex ? *it + 1 : *it;
+        MemberListEntry mleItem = memberNode->memberList.at(index);
+        Address destination = makeAddress(mleItem.id, mleItem.port);
+        if (par->PIGGYBACK_GOSSIP && toldOverKV(destination)) {
+            continue;
+        }
+        vector<GossipEntry> entries;
+        collectGossipEntries(memberKey(mleItem.id, mleItem.port), entries);
+        sendGossipEntries(&destination, MEMBER_TABLE, entries, NULL, par->PUSH_PULL ? 1 : 0);
+        ////cout << " sending member table from " << getMyId() << ":to:" << mleItem.id << endl;
+    }
+}
 
-    //copy the menber list table - but don't send items that are older than TFAIL
-    for (unsigned int i =0; i < memberNode->memberList.size(); i++) {
-         if ((memberNode->memberList[i].gettimestamp() + TFAIL) > par->getcurrtime()) {
-             message->memberList.push_back(memberNode->memberList[i]);
-         }
+/**
+ * FUNCTION NAME: toldOverKV
+ *
+ * DESCRIPTION: Whether a KV message carried a membership digest to a peer in the last
+ *              tick, so that the peer can do without a gossip frame this tick. The older
+ *              entries it would have got reach it from the rest of the group.
+ */
+bool MP1Node::toldOverKV(Address &peer) {
+    map<string, int>::iterator sent = memberNode->kvDigestSent.find(string(peer.addr, sizeof(peer.addr)));
+    return sent != memberNode->kvDigestSent.end() && sent->second >= par->getcurrtime() - 1;
+}
+
+/**
+ * FUNCTION NAME: gossipFanout
+ *
+ * DESCRIPTION: Number of peers to gossip to per tick in a group of groupSize. Unless
+ *              GOSSIP_FANOUT fixes it, this grows as ln(N) + 1, which is enough for an
+ *              epidemic to reach every member with high probability, and is never below
+ *              SPREAD_RATE.
+ */
+int MP1Node::gossipFanout(int groupSize) {
+    if (par->GOSSIP_FANOUT > 0) {
+        return par->GOSSIP_FANOUT;
     }
+    int fanout = (int)ceil(::log((double)max(groupSize, 1))) + 1;
+    return max(fanout, SPREAD_RATE);
+}
 
+/**
+ * FUNCTION NAME: collectGossipEntries
+ *
+ * DESCRIPTION: Pick the entries to gossip to one peer. Entries older than TFAIL are never sent.
+ *              With GOSSIP_DELTA only the entries whose heartbeat moved since the peer was
+ *              last told are sent, and every FULL_SYNC_INTERVAL ticks the peer gets the whole
+ *              table again in case a delta was dropped. It is off by default: every live
+ *              heartbeat moves every tick, so a delta is barely smaller than the table.
+ */
+void MP1Node::collectGossipEntries(long peerKey, vector<GossipEntry> &entries) {
+    int now = par->getcurrtime();
+    GossipPeer &peer = gossipPeers[peerKey];
+
+    bool fullSync = !par->GOSSIP_DELTA
+            || peer.lastFullSync < 0
+            || (now - peer.lastFullSync) >= FULL_SYNC_INTERVAL;
+
+    for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+        MemberListEntry entry = memberNode->memberList.at(i);
+        if ((entry.gettimestamp() + TFAIL) <= now) {
+            continue;
+        }
+        //the timestamp moves whenever the heartbeat does
+        if (!fullSync && entry.gettimestamp() <= peer.lastTold) {
+            continue;
+        }
+        GossipEntry gossipEntry;
+        gossipEntry.id = entry.getid();
+        gossipEntry.port = entry.getport();
+        gossipEntry.state = MEMBER_ALIVE;
+        gossipEntry.heartbeat = entry.getheartbeat();
+        entries.push_back(gossipEntry);
+    }
 
-    //copy the heartbeat
+    peer.lastTold = now;
+    if (fullSync) {
+        peer.lastFullSync = now;
+    }
+}
+
+/**
+ * FUNCTION NAME: sendGossipEntries
+ *
+ * DESCRIPTION: Pack the entries behind a message header and send them, split into as many
+ *              frames as MAX_MSG_SIZE requires. An empty list still sends one frame, as it
+ *              carries this node's heartbeat.
+ */
+void MP1Node::sendGossipEntries(Address *destination, enum MessageTypes type, vector<GossipEntry> &entries,
+                                Address *target, int param) {
+    int maxEntries = (par->MAX_MSG_SIZE - sizeof(en_msg) - sizeof(MembershipMessage) - 1) / sizeof(GossipEntry);
+    size_t sent = 0;
+
+    do {
+        int count = min((int)(entries.size() - sent), maxEntries);
+        size_t messageSize = sizeof(MembershipMessage) + count * sizeof(GossipEntry);
+        MembershipMessage *message = (MembershipMessage *) malloc(messageSize);
+
+        message->messageType = type;
+        //the sent message gets assigned the FROM address
+        message->address = memberNode->addr;
+        if (target != NULL) {
+            message->target = *target;
+        } else {
+            message->target.init();
+        }
+        message->heartbeat = memberNode->heartbeat;
+        message->param = param;
+        message->entryCount = count;
+        if (count > 0) {
+            memcpy((char *)(message + 1), &entries[sent], count * sizeof(GossipEntry));
+        }
+
+        emulNet->ENsend(&memberNode->addr, destination, (char *)message, messageSize);
+        free(message);
+
+        gossipFramesSent++;
+        gossipEntriesSent += count;
+        gossipBytesSent += messageSize;
+        sent += count;
+    } while (sent < entries.size());
+}
+
+/**
+ * FUNCTION NAME: logGossipStats
+ *
+ * DESCRIPTION: Write the gossip volume sent by this node and the memory held by its
+ *              membership table to the stats log
+ */
+void MP1Node::logGossipStats() {
+    log->LOG(&memberNode->addr, "#STATSLOG# gossip frames %ld entries %ld bytes %ld",
+             gossipFramesSent, gossipEntriesSent, gossipBytesSent);
+    log->LOG(&memberNode->addr, "#STATSLOG# membership table bytes %lu",
+             (unsigned long)memberNode->memberList.bytesUsed());
+}
+
+/******************************************************************************
+ *
+ * SWIM failure detection
+ *
+ * Selected with MEMBERSHIP_MODE: 1. Every SWIM_PERIOD ticks a node pings the next
+ * member of a shuffled round robin order. Without an ack after SWIM_ACK_TIMEOUT it
+ * asks SWIM_PING_REQ_MEMBERS other members to ping the target for it, and without
+ * any ack by the end of the period the target becomes a suspect. A suspect that does
+ * not refute with a higher incarnation within SWIM_SUSPECT_TIMEOUT is removed.
+ * Membership changes ride on the pings and acks, so every node sends about one
+ * probe and one ack per period whatever the size of the group.
+ *
+ *****************************************************************************/
+
+/**
+ * FUNCTION NAME: swimLoopOps
+ *
+ * DESCRIPTION: Run one tick of the SWIM protocol
+ */
+void MP1Node::swimLoopOps() {
+    int now = par->getcurrtime();
+
+    //this node's heartbeat is its incarnation number and only moves to refute a suspicion
+    updateMemberList(getMyId(), getMyPort(), memberNode->heartbeat);
+
+    //finish or escalate the probe in flight
+    if (probeKey >= 0) {
+        Address target = makeAddress((int)(probeKey >> 16), (short)(probeKey & 0xffff));
+        if (probeAcked) {
+            probeKey = -1;
+        } else if (now - probeStart >= SWIM_PERIOD) {
+            suspectMember(probeKey);
+            probeKey = -1;
+        } else if (!pingReqSent && now - probeStart >= SWIM_ACK_TIMEOUT) {
+            //ask k random members to probe the target for us
+            vector<int> helpers;
+            for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+                long key = memberKey(memberNode->memberList.getid(i), memberNode->memberList.getport(i));
+                if (key != probeKey && memberNode->memberList.getid(i) != getMyId()) {
+                    helpers.push_back(i);
+                }
+            }
+            for (int i = 0; i < SWIM_PING_REQ_MEMBERS && i < (int)helpers.size(); i++) {
+                swap(helpers[i], helpers[i + rand() % (helpers.size() - i)]);
+                MemberListEntry helper = memberNode->memberList.at(helpers[i]);
+                Address destination = makeAddress(helper.getid(), helper.getport());
+                sendSwimMessage(&destination, PING_REQ, &target);
+            }
+            pingReqSent = true;
+        }
+    }
+
+    //start the next probe once per protocol period
+    if (probeKey < 0 && now >= nextProbeTime) {
+        long key = nextProbeTarget();
+        if (key >= 0) {
+            Address target = makeAddress((int)(key >> 16), (short)(key & 0xffff));
+            Address noRelay;
+            noRelay.init();
+            probeKey = key;
+            probeStart = now;
+            probeAcked = false;
+            pingReqSent = false;
+            sendSwimMessage(&target, PING, &noRelay);
+        }
+        nextProbeTime = now + SWIM_PERIOD;
+    }
+
+    //remove the suspects that did not refute in time
+    vector<long> expired;
+    for (map<long, SwimMember>::iterator it = swimMembers.begin(); it != swimMembers.end(); ++it) {
+        if (it->second.state == MEMBER_SUSPECT && now - it->second.suspectTime >= SWIM_SUSPECT_TIMEOUT) {
+            expired.push_back(it->first);
+        }
+    }
+    for (unsigned int i = 0; i < expired.size(); i++) {
+        int id = (int)(expired[i] >> 16);
+        short port = (short)(expired[i] & 0xffff);
+        int member = findMember(id, port);
+        confirmMember(id, port, member >= 0 ? memberNode->memberList.getheartbeat(member) : 0, MEMBER_CONFIRMED);
+    }
+}
+
+/**
+ * FUNCTION NAME: nextProbeTarget
+ *
+ * DESCRIPTION: Return the key of the next member to probe. Members are probed in a
+ *              random order that is reshuffled after every full pass, which bounds
+ *              the time until any failed member gets probed.
+ */
+long MP1Node::nextProbeTarget() {
+    for (int pass = 0; pass < 2; pass++) {
+        while (probeIndex < probeOrder.size()) {
+            long key = probeOrder[probeIndex++];
+            if (findMember((int)(key >> 16), (short)(key & 0xffff)) >= 0) {
+                return key;
+            }
+        }
+
+        //start a new pass over the current members
+        probeOrder.clear();
+        probeIndex = 0;
+        for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+            MemberListEntry entry = memberNode->memberList.at(i);
+            if (entry.getid() != getMyId() || entry.getport() != getMyPort()) {
+                probeOrder.push_back(memberKey(entry.getid(), entry.getport()));
+            }
+        }
+        for (int i = (int)probeOrder.size() - 1; i > 0; i--) {
+            swap(probeOrder[i], probeOrder[rand() % (i + 1)]);
+        }
+    }
+    return -1;
+}
+
+/**
+ * FUNCTION NAME: sendSwimMessage
+ *
+ * DESCRIPTION: Send a PING, ACK or PING_REQ with as many pending membership updates
+ *              piggybacked as SWIM_MAX_PIGGYBACK allows, freshest first
+ */
+void MP1Node::sendSwimMessage(Address *destination, enum MessageTypes type, Address *target) {
+    sort(swimUpdates.begin(), swimUpdates.end(), [](const SwimUpdate &a, const SwimUpdate &b) {
+        return a.transmitsLeft > b.transmitsLeft;
+    });
+
+    int count = min((int)swimUpdates.size(), SWIM_MAX_PIGGYBACK);
+    size_t messageSize = sizeof(MembershipMessage) + count * sizeof(GossipEntry);
+    MembershipMessage *message = (MembershipMessage *) malloc(messageSize);
+    GossipEntry *entries = (GossipEntry *)(message + 1);
+
+    message->messageType = type;
+    message->address = memberNode->addr;
+    message->target = *target;
     message->heartbeat = memberNode->heartbeat;
+    message->param = 0;
+    message->entryCount = count;
+    for (int i = 0; i < count; i++) {
+        entries[i] = swimUpdates[i].entry;
+        swimUpdates[i].transmitsLeft--;
+    }
+
+    emulNet->ENsend(&memberNode->addr, destination, (char *)message, messageSize);
+    free(message);
 
-    size_t messageSize = sizeof(MembershipMessage);
+    gossipFramesSent++;
+    gossipEntriesSent += count;
+    gossipBytesSent += messageSize;
+
+    //drop the updates that have been sent often enough
+    swimUpdates.erase(remove_if(swimUpdates.begin(), swimUpdates.end(), [](const SwimUpdate &u) {
+        return u.transmitsLeft <= 0;
+    }), swimUpdates.end());
+}
+
+/**
+ * FUNCTION NAME: queueSwimUpdate
+ *
+ * DESCRIPTION: Queue a membership update for dissemination, replacing any older
+ *              update about the same member. Each update is sent
+ *              SWIM_RETRANSMIT_MULT * log2(N) times.
+ */
+void MP1Node::queueSwimUpdate(int id, short port, long incarnation, int state) {
+    SwimUpdate update;
+    update.entry.id = id;
+    update.entry.port = port;
+    update.entry.state = state;
+    update.entry.heartbeat = incarnation;
+    update.transmitsLeft = SWIM_RETRANSMIT_MULT * (int)ceil(log2(memberNode->memberList.size() + 1));
+
+    for (unsigned int i = 0; i < swimUpdates.size(); i++) {
+        if (swimUpdates[i].entry.id == id && swimUpdates[i].entry.port == port) {
+            swimUpdates[i] = update;
+            return;
+        }
+    }
+    swimUpdates.push_back(update);
+}
+
+/**
+ * FUNCTION NAME: applySwimUpdates
+ *
+ * DESCRIPTION: Apply the sender's own liveness and the updates piggybacked on a message
+ */
+void MP1Node::applySwimUpdates(MembershipMessage *message) {
+    GossipEntry sender;
+    sender.id = getAddressId(message->address);
+    sender.port = getAddressPort(message->address);
+    sender.state = MEMBER_ALIVE;
+    sender.heartbeat = message->heartbeat;
+    applySwimUpdate(sender);
+
+    GossipEntry *entries = (GossipEntry *)(message + 1);
+    for (int i = 0; i < message->entryCount; i++) {
+        applySwimUpdate(entries[i]);
+    }
+}
+
+/**
+ * FUNCTION NAME: applySwimUpdate
+ *
+ * DESCRIPTION: Apply one alive, suspect or confirm update. A higher incarnation
+ *              overrides a lower one, and a suspicion overrides an alive update with
+ *              the same incarnation. A suspicion about this node is refuted by
+ *              bumping its incarnation.
+ */
+void MP1Node::applySwimUpdate(GossipEntry &update) {
+    long key = memberKey(update.id, update.port);
+
+    if (update.id == getMyId() && update.port == getMyPort()) {
+        if (update.state != MEMBER_ALIVE && update.heartbeat >= memberNode->heartbeat) {
+            memberNode->heartbeat = update.heartbeat + 1;
+            updateMemberList(getMyId(), getMyPort(), memberNode->heartbeat);
+            queueSwimUpdate(getMyId(), getMyPort(), memberNode->heartbeat, MEMBER_ALIVE);
+        }
+        return;
+    }
 
+    //ignore stale news about members that were already confirmed failed
+    map<long, long>::iterator confirmed = swimConfirmed.find(key);
+    if (confirmed != swimConfirmed.end() && update.heartbeat <= confirmed->second) {
+        return;
+    }
 
-    //select n random elements
-    vector<MemberListEntry>::iterator begin = memberNode->memberList.begin();
-    size_t left = distance(begin , memberNode->memberList.end());
+    int member = findMember(update.id, update.port);
+    if (update.state == MEMBER_CONFIRMED || update.state == MEMBER_DEPARTED) {
+        if (member >= 0) {
+            confirmMember(update.id, update.port, update.heartbeat, update.state);
+        }
+        return;
+    }
 
-    for (int i = sendCount; i>0; i--) {
-        vector<MemberListEntry>::iterator r = memberNode->memberList.begin();
-        std::advance(r, rand()%left);
-        std::swap(*begin, *r);
-        ++begin;
-        --left;
+    if (member < 0) {
+        updateMemberList(update.id, update.port, update.heartbeat);
+        swimMembers[key].state = MEMBER_ALIVE;
+        queueSwimUpdate(update.id, update.port, update.heartbeat, MEMBER_ALIVE);
+        member = findMember(update.id, update.port);
+        if (update.state == MEMBER_ALIVE) {
+            return;
+        }
     }
 
-    for (int i = 1; (i <= sendCount); i++) {
-        MemberListEntry mleItem = memberNode->memberList[i];
-        if((mleItem.id != getMyId())) {
-            Address destination = makeAddress(mleItem.id, mleItem.port);
-            emulNet->ENsend(&memberNode->addr, &destination, (char *)message, messageSize);
-            ////cout << " sending member table from " << getMyId() << ":to:" << mleItem.id << endl;
+    MemberTable &members = memberNode->memberList;
+    SwimMember &state = swimMembers[key];
+    if (update.state == MEMBER_ALIVE) {
+        if (update.heartbeat > members.getheartbeat(member)) {
+            members.setheartbeat(member, update.heartbeat);
+            members.settimestamp(member, par->getcurrtime());
+            state.state = MEMBER_ALIVE;
+            queueSwimUpdate(update.id, update.port, update.heartbeat, MEMBER_ALIVE);
         }
+    } else if (update.heartbeat > members.getheartbeat(member)
+               || (update.heartbeat == members.getheartbeat(member) && state.state == MEMBER_ALIVE)) {
+        members.setheartbeat(member, update.heartbeat);
+        state.state = MEMBER_SUSPECT;
+        state.suspectTime = par->getcurrtime();
+        queueSwimUpdate(update.id, update.port, update.heartbeat, MEMBER_SUSPECT);
     }
 }
 
+/**
+ * FUNCTION NAME: suspectMember
+ *
+ * DESCRIPTION: Mark a member that failed its probe as a suspect
+ */
+void MP1Node::suspectMember(long key) {
+    GossipEntry update;
+    update.id = (int)(key >> 16);
+    update.port = (short)(key & 0xffff);
+    int member = findMember(update.id, update.port);
+    if (member < 0 || swimMembers[key].state == MEMBER_SUSPECT) {
+        return;
+    }
+    update.state = MEMBER_SUSPECT;
+    update.heartbeat = memberNode->memberList.getheartbeat(member);
+    applySwimUpdate(update);
+}
+
+/**
+ * FUNCTION NAME: confirmMember
+ *
+ * DESCRIPTION: Remove a member confirmed failed or departed and tell the group
+ */
+void MP1Node::confirmMember(int id, short port, long incarnation, int state) {
+    long key = memberKey(id, port);
+    removeMember(id, port, state == MEMBER_DEPARTED);
+    swimMembers.erase(key);
+    swimConfirmed[key] = incarnation;
+    queueSwimUpdate(id, port, incarnation, state);
+}
+
+/**
+ * FUNCTION NAME: handlePing
+ *
+ * DESCRIPTION: Answer a direct or indirect probe. The ack goes back to whoever sent the
+ *              ping and names the original requester when the ping was indirect.
+ */
+void MP1Node::handlePing(MembershipMessage *message) {
+    applySwimUpdates(message);
+    sendSwimMessage(&message->address, ACK, &message->target);
+}
+
+/**
+ * FUNCTION NAME: handleAck
+ *
+ * DESCRIPTION: Complete this node's probe, or relay the ack of an indirect probe
+ */
+void MP1Node::handleAck(MembershipMessage *message) {
+    applySwimUpdates(message);
+
+    if (!isNullAddress(&message->target) && !(message->target == memberNode->addr)) {
+        //relay the ack unchanged, so it still names the probed member
+        emulNet->ENsend(&memberNode->addr, &message->target, (char *)message,
+                        sizeof(MembershipMessage) + message->entryCount * sizeof(GossipEntry));
+        return;
+    }
+
+    if (probeKey == memberKey(getAddressId(message->address), getAddressPort(message->address))) {
+        probeAcked = true;
+    }
+}
+
+/**
+ * FUNCTION NAME: handlePingReq
+ *
+ * DESCRIPTION: Probe a member on behalf of the requester
+ */
+void MP1Node::handlePingReq(MembershipMessage *message) {
+    applySwimUpdates(message);
+    sendSwimMessage(&message->target, PING, &message->address);
+}
+
+/**
+ * FUNCTION NAME: hasFailed
+ *
+ * DESCRIPTION: Decide whether a member of the gossip membership list has failed. The
+ *              timeout detector removes a member after TREMOVE ticks without a heartbeat.
+ *              The phi accrual detector removes it once its silence is unlikely enough
+ *              for its own heartbeat history, and falls back on TREMOVE until it has
+ *              seen a few heartbeats.
+ */
+bool MP1Node::hasFailed(size_t i) {
+    int now = par->getcurrtime();
+    MemberTable &members = memberNode->memberList;
+    long key = memberKey(members.getid(i), members.getport(i));
+
+    if (par->FAILURE_DETECTOR != PHI_ACCRUAL_DETECTOR || detector.samples(key) < 3) {
+        return now - members.gettimestamp(i) > TREMOVE;
+    }
+    return detector.phi(key, now) > par->PHI_THRESHOLD;
+}
+
+/**
+ * FUNCTION NAME: removeExpired
+ *
+ * DESCRIPTION: Remove the members at the given ordered positions and publish their removal.
+ *              The list is compacted in a single pass, and MP2Node picks all the removal
+ *              events up together on its next ring update.
+ */
+void MP1Node::removeExpired(vector<size_t> &expired) {
+    MemberTable &members = memberNode->memberList;
+    for (size_t j = 0; j < expired.size(); j++) {
+        Address addr = makeAddress(members.getid(expired[j]), members.getport(expired[j]));
+        log->logNodeRemove(&memberNode->addr, &addr);
+        memberNode->addMembershipEvent(MEMBER_LEFT, addr);
+        detector.remove(memberKey(members.getid(expired[j]), members.getport(expired[j])));
+        gossipPeers.erase(memberKey(members.getid(expired[j]), members.getport(expired[j])));
+        if (getMyId() == 10) {
+            //cout << "timing out node " << addr.getAddress() << " from " << memberNode->addr.getAddress() << endl;
+            logMemberStatus();
+        }
+    }
+    members.erase(expired);
+}
+
+/**
+ * FUNCTION NAME: findMember
+ *
+ * DESCRIPTION: Return the position of a member in the membership list, or -1
+ */
+int MP1Node::findMember(int id, short port) {
+    return memberNode->memberList.find(id, port);
+}
+
+/**
+ * FUNCTION NAME: removeMember
+ *
+ * DESCRIPTION: Remove a member from the membership list and log it
+ */
+void MP1Node::removeMember(int id, short port, bool graceful) {
+    int found = findMember(id, port);
+    if (found < 0) {
+        return;
+    }
+    Address addr = makeAddress(id, port);
+    log->logNodeRemove(&memberNode->addr, &addr);
+    memberNode->addMembershipEvent(MEMBER_LEFT, addr, graceful);
+    memberNode->memberList.erase(found);
+}
+
+/******************************************************************************
+ *
+ * HyParView partial views
+ *
+ * Selected with MEMBERSHIP_MODE: 2. A node keeps HPV_ACTIVE_SIZE neighbours in
+ * memberList and up to HPV_PASSIVE_SIZE backups in passiveView, whatever the size of
+ * the group. Neighbours exchange a keepalive every tick, and a failed neighbour is
+ * replaced from the passive view. Shuffles keep the passive views mixed.
+ *
+ * The ring is tracked apart from the views in ringState, one alive or confirmed
+ * entry per member. A change is flooded over the active views, which reach every
+ * node, and a full copy goes to one neighbour every HPV_RING_SYNC_PERIOD ticks in
+ * case a flood was dropped. MP2Node builds its ring from memberNode->ringList.
+ *
+ *****************************************************************************/
+
+/**
+ * FUNCTION NAME: hpvLoopOps
+ *
+ * DESCRIPTION: Run one tick of the HyParView protocol
+ */
+void MP1Node::hpvLoopOps() {
+    int now = par->getcurrtime();
+
+    //drop the neighbours that went silent, and suspect them until probed
+    vector<MemberListEntry> silent;
+    for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+        if (now - memberNode->memberList.gettimestamp(i) > TFAIL) {
+            silent.push_back(memberNode->memberList.at(i));
+        }
+    }
+    for (unsigned int i = 0; i < silent.size(); i++) {
+        removeActive(silent[i].getid(), silent[i].getport());
+        suspects[memberKey(silent[i].getid(), silent[i].getport())] = now;
+    }
+
+    //probe the suspects, and tell the ring of the ones that never answer
+    vector<GossipEntry> failed;
+    for (map<long, int>::iterator it = suspects.begin(); it != suspects.end();) {
+        map<long, GossipEntry>::iterator ring = ringState.find(it->first);
+        if (ring == ringState.end() || ring->second.state != MEMBER_ALIVE) {
+            suspects.erase(it++);
+        } else if (now - it->second >= HPV_DEATH_PROBES * HPV_NEIGHBOR_TIMEOUT) {
+            GossipEntry entry = ring->second;
+            entry.state = MEMBER_CONFIRMED;
+            applyRingEntry(entry);
+            failed.push_back(entry);
+            suspects.erase(it++);
+        } else {
+            if ((now - it->second) % HPV_NEIGHBOR_TIMEOUT == 0) {
+                Address destination = makeAddress((int)(it->first >> 16), (short)(it->first & 0xffff));
+                vector<GossipEntry> none;
+                sendGossipEntries(&destination, NEIGHBOR, none, NULL, 0);
+            }
+            ++it;
+        }
+    }
+    if (!failed.empty()) {
+        floodRing(failed, -1);
+    }
+
+    //refill the active view from the passive view, one request at a time
+    if (pendingNeighbor >= 0 && now - neighborStart > HPV_NEIGHBOR_TIMEOUT) {
+        removePassive(pendingNeighbor);
+        pendingNeighbor = -1;
+    }
+    if (pendingNeighbor < 0 && memberNode->memberList.size() < HPV_ACTIVE_SIZE) {
+        if (!passiveView.empty()) {
+            pendingNeighbor = passiveView[rand() % passiveView.size()];
+            Address destination = makeAddress((int)(pendingNeighbor >> 16), (short)(pendingNeighbor & 0xffff));
+            vector<GossipEntry> none;
+            sendGossipEntries(&destination, NEIGHBOR, none, NULL, memberNode->memberList.empty() ? 1 : 0);
+            neighborStart = now;
+        } else if (memberNode->memberList.empty()) {
+            //cut off from the group, so join again through the introducer
+            Address joinAddress = getIntroducerAddress(joinAttempts);
+            if (!(joinAddress == memberNode->addr) && now - neighborStart > HPV_NEIGHBOR_TIMEOUT) {
+                introduceSelfToGroup(&joinAddress);
+                neighborStart = now;
+                joinAttempts++;
+            }
+        }
+    }
+
+    //keep the links alive
+    for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+        Address destination = makeAddress(memberNode->memberList.getid(i), memberNode->memberList.getport(i));
+        vector<GossipEntry> none;
+        sendGossipEntries(&destination, KEEPALIVE, none);
+    }
+
+    //shuffle a sample of both views with a node a random walk away
+    if (now >= nextShuffleTime && !memberNode->memberList.empty()) {
+        vector<GossipEntry> sample;
+        GossipEntry entry;
+        entry.id = getMyId();
+        entry.port = getMyPort();
+        entry.state = MEMBER_ALIVE;
+        entry.heartbeat = memberNode->heartbeat;
+        sample.push_back(entry);
+
+        vector<long> active;
+        for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+            active.push_back(memberKey(memberNode->memberList.getid(i), memberNode->memberList.getport(i)));
+        }
+        vector<long> passive = passiveView;
+        random_shuffle(active.begin(), active.end());
+        random_shuffle(passive.begin(), passive.end());
+        for (unsigned int i = 0; i < active.size() && i < HPV_SHUFFLE_ACTIVE; i++) {
+            entry.id = (int)(active[i] >> 16);
+            entry.port = (short)(active[i] & 0xffff);
+            entry.heartbeat = 0;
+            sample.push_back(entry);
+        }
+        for (unsigned int i = 0; i < passive.size() && i < HPV_SHUFFLE_PASSIVE; i++) {
+            entry.id = (int)(passive[i] >> 16);
+            entry.port = (short)(passive[i] & 0xffff);
+            entry.heartbeat = 0;
+            sample.push_back(entry);
+        }
+
+        long key = randomActive(-1, -1);
+        Address destination = makeAddress((int)(key >> 16), (short)(key & 0xffff));
+        sendGossipEntries(&destination, SHUFFLE, sample, &memberNode->addr, HPV_PASSIVE_RWL);
+        nextShuffleTime = now + HPV_SHUFFLE_PERIOD;
+    }
+
+    //repair any ring updates that a flood missed
+    if (now >= nextRingSyncTime && !memberNode->memberList.empty()) {
+        long key = randomActive(-1, -1);
+        Address destination = makeAddress((int)(key >> 16), (short)(key & 0xffff));
+        vector<GossipEntry> entries;
+        collectRingEntries(entries);
+        sendGossipEntries(&destination, RING_UPDATE, entries);
+        nextRingSyncTime = now + HPV_RING_SYNC_PERIOD;
+    }
+
+    updateRingList();
+}
+
+/**
+ * FUNCTION NAME: handleForwardJoin
+ *
+ * DESCRIPTION: Pass a join on along a random walk. The joiner is taken into the active
+ *              view at the end of the walk and into the passive view HPV_PASSIVE_RWL
+ *              hops in.
+ */
+void MP1Node::handleForwardJoin(MembershipMessage *message) {
+    int id = getAddressId(message->target);
+    short port = getAddressPort(message->target);
+    long joiner = memberKey(id, port);
+    long next = randomActive(memberKey(getAddressId(message->address), getAddressPort(message->address)), joiner);
+
+    if (message->param <= 0 || next < 0) {
+        if (addActive(id, port)) {
+            vector<GossipEntry> none;
+            sendGossipEntries(&message->target, NEIGHBOR, none, NULL, 1);
+        }
+        return;
+    }
+
+    if (message->param == HPV_PASSIVE_RWL) {
+        addPassive(id, port);
+    }
+    Address destination = makeAddress((int)(next >> 16), (short)(next & 0xffff));
+    vector<GossipEntry> none;
+    sendGossipEntries(&destination, FORWARD_JOIN, none, &message->target, message->param - 1);
+}
+
+/**
+ * FUNCTION NAME: handleNeighbor
+ *
+ * DESCRIPTION: Answer a request to join this node's active view. A high priority
+ *              request comes from a node with no neighbours left and is always taken.
+ */
+void MP1Node::handleNeighbor(MembershipMessage *message) {
+    bool accept = message->param == 1 || memberNode->memberList.size() < HPV_ACTIVE_SIZE;
+    if (accept) {
+        addActive(getAddressId(message->address), getAddressPort(message->address));
+    }
+    vector<GossipEntry> none;
+    sendGossipEntries(&message->address, NEIGHBOR_REPLY, none, NULL, accept ? 1 : 0);
+}
+
+/**
+ * FUNCTION NAME: handleNeighborReply
+ *
+ * DESCRIPTION: Promote a passive member that accepted this node as a neighbour
+ */
+void MP1Node::handleNeighborReply(MembershipMessage *message) {
+    long key = memberKey(getAddressId(message->address), getAddressPort(message->address));
+    if (message->param == 1) {
+        addActive(getAddressId(message->address), getAddressPort(message->address));
+    }
+    if (key == pendingNeighbor) {
+        pendingNeighbor = -1;
+    }
+}
+
+/**
+ * FUNCTION NAME: handleDisconnect
+ *
+ * DESCRIPTION: A neighbour dropped this node from its active view, so keep it as a backup
+ */
+void MP1Node::handleDisconnect(MembershipMessage *message) {
+    int id = getAddressId(message->address);
+    short port = getAddressPort(message->address);
+    if (findMember(id, port) >= 0) {
+        removeActive(id, port);
+        addPassive(id, port);
+    }
+}
+
+/**
+ * FUNCTION NAME: handleShuffle
+ *
+ * DESCRIPTION: Pass a shuffle on along its random walk, or answer it with a sample of
+ *              the passive view and keep the members it carries
+ */
+void MP1Node::handleShuffle(MembershipMessage *message) {
+    long origin = memberKey(getAddressId(message->target), getAddressPort(message->target));
+    long next = randomActive(memberKey(getAddressId(message->address), getAddressPort(message->address)), origin);
+    vector<GossipEntry> entries((GossipEntry *)(message + 1), (GossipEntry *)(message + 1) + message->entryCount);
+
+    if (message->param > 0 && next >= 0) {
+        Address destination = makeAddress((int)(next >> 16), (short)(next & 0xffff));
+        sendGossipEntries(&destination, SHUFFLE, entries, &message->target, message->param - 1);
+        return;
+    }
+
+    vector<long> passive = passiveView;
+    random_shuffle(passive.begin(), passive.end());
+    vector<GossipEntry> reply;
+    for (unsigned int i = 0; i < passive.size() && i < entries.size(); i++) {
+        GossipEntry entry;
+        entry.id = (int)(passive[i] >> 16);
+        entry.port = (short)(passive[i] & 0xffff);
+        entry.state = MEMBER_ALIVE;
+        entry.heartbeat = 0;
+        reply.push_back(entry);
+    }
+    if (origin != memberKey(getMyId(), getMyPort())) {
+        sendGossipEntries(&message->target, SHUFFLE_REPLY, reply);
+    }
+    mergePassive(message);
+}
+
+/**
+ * FUNCTION NAME: handleShuffleReply
+ *
+ * DESCRIPTION: Keep the members sent back for this node's shuffle
+ */
+void MP1Node::handleShuffleReply(MembershipMessage *message) {
+    mergePassive(message);
+}
+
+/**
+ * FUNCTION NAME: handleKeepalive
+ *
+ * DESCRIPTION: Take a keepalive from a node that is not a neighbour as a neighbour
+ *              request, as its NEIGHBOR exchange may have been lost halfway
+ */
+void MP1Node::handleKeepalive(MembershipMessage *message) {
+    int id = getAddressId(message->address);
+    short port = getAddressPort(message->address);
+    if (findMember(id, port) >= 0) {
+        return;
+    }
+    if (memberNode->memberList.size() < HPV_ACTIVE_SIZE) {
+        addActive(id, port);
+    } else {
+        vector<GossipEntry> none;
+        sendGossipEntries(&message->address, DISCONNECT, none);
+    }
+}
+
+/**
+ * FUNCTION NAME: handleRingUpdate
+ *
+ * DESCRIPTION: Apply ring updates and flood the ones that were news to the other neighbours
+ */
+void MP1Node::handleRingUpdate(MembershipMessage *message) {
+    GossipEntry *entries = (GossipEntry *)(message + 1);
+    vector<GossipEntry> changed;
+    for (int i = 0; i < message->entryCount; i++) {
+        GossipEntry entry = entries[i];
+        if (applyRingEntry(entry)) {
+            changed.push_back(entry);
+        }
+    }
+    if (!changed.empty()) {
+        floodRing(changed, memberKey(getAddressId(message->address), getAddressPort(message->address)));
+    }
+}
+
+/**
+ * FUNCTION NAME: addActive
+ *
+ * DESCRIPTION: Add a member to the active view, dropping a random neighbour to the
+ *              passive view when it is full. Returns false if it was already there.
+ */
+bool MP1Node::addActive(int id, short port) {
+    if ((id == getMyId() && port == getMyPort()) || findMember(id, port) >= 0) {
+        return false;
+    }
+    if (memberNode->memberList.size() >= HPV_ACTIVE_SIZE) {
+        MemberListEntry dropped = memberNode->memberList.at(rand() % memberNode->memberList.size());
+        Address destination = makeAddress(dropped.getid(), dropped.getport());
+        vector<GossipEntry> none;
+        sendGossipEntries(&destination, DISCONNECT, none);
+        removeActive(dropped.getid(), dropped.getport());
+        addPassive(dropped.getid(), dropped.getport());
+    }
+
+    removePassive(memberKey(id, port));
+    memberNode->memberList.insert(id, port, 0, par->getcurrtime());
+    return true;
+}
+
+/**
+ * FUNCTION NAME: removeActive
+ *
+ * DESCRIPTION: Remove a member from the active view
+ */
+void MP1Node::removeActive(int id, short port) {
+    int found = findMember(id, port);
+    if (found >= 0) {
+        memberNode->memberList.erase(found);
+    }
+}
+
+/**
+ * FUNCTION NAME: addPassive
+ *
+ * DESCRIPTION: Add a member to the passive view, evicting a random one when it is full
+ */
+void MP1Node::addPassive(int id, short port) {
+    long key = memberKey(id, port);
+    if ((id == getMyId() && port == getMyPort()) || findMember(id, port) >= 0
+        || find(passiveView.begin(), passiveView.end(), key) != passiveView.end()) {
+        return;
+    }
+    if (passiveView.size() >= HPV_PASSIVE_SIZE) {
+        passiveView[rand() % passiveView.size()] = key;
+    } else {
+        passiveView.push_back(key);
+    }
+}
+
+/**
+ * FUNCTION NAME: removePassive
+ *
+ * DESCRIPTION: Remove a member from the passive view
+ */
+void MP1Node::removePassive(long key) {
+    vector<long>::iterator found = find(passiveView.begin(), passiveView.end(), key);
+    if (found != passiveView.end()) {
+        passiveView.erase(found);
+    }
+}
+
+/**
+ * FUNCTION NAME: mergePassive
+ *
+ * DESCRIPTION: Add the members carried by a shuffle to the passive view, leaving out
+ *              the ones known to have failed
+ */
+void MP1Node::mergePassive(MembershipMessage *message) {
+    GossipEntry *entries = (GossipEntry *)(message + 1);
+    for (int i = 0; i < message->entryCount; i++) {
+        map<long, GossipEntry>::iterator ring = ringState.find(memberKey(entries[i].id, entries[i].port));
+        if (ring == ringState.end() || ring->second.state == MEMBER_ALIVE) {
+            addPassive(entries[i].id, entries[i].port);
+        }
+    }
+}
+
+/**
+ * FUNCTION NAME: randomActive
+ *
+ * DESCRIPTION: Return the key of a random neighbour other than the two given, or -1
+ */
+long MP1Node::randomActive(long exclude, long alsoExclude) {
+    vector<long> candidates;
+    for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+        long key = memberKey(memberNode->memberList.getid(i), memberNode->memberList.getport(i));
+        if (key != exclude && key != alsoExclude) {
+            candidates.push_back(key);
+        }
+    }
+    if (candidates.empty()) {
+        return -1;
+    }
+    return candidates[rand() % candidates.size()];
+}
+
+/**
+ * FUNCTION NAME: applyRingEntry
+ *
+ * DESCRIPTION: Apply one ring update. A higher incarnation overrides a lower one and a
+ *              confirmed failure overrides an alive entry with the same incarnation.
+ *              A failure reported for this node is refuted by bumping its incarnation,
+ *              and the entry is replaced by the refutation to pass on. Returns true if
+ *              the update was news.
+ */
+bool MP1Node::applyRingEntry(GossipEntry &entry) {
+    long key = memberKey(entry.id, entry.port);
+    map<long, GossipEntry>::iterator found = ringState.find(key);
+
+    if (entry.id == getMyId() && entry.port == getMyPort() && found != ringState.end()) {
+        if (entry.state == MEMBER_ALIVE || entry.heartbeat < memberNode->heartbeat) {
+            return false;
+        }
+        memberNode->heartbeat = entry.heartbeat + 1;
+        found->second.heartbeat = memberNode->heartbeat;
+        entry = found->second;
+        return true;
+    }
+
+    bool wasAlive = false;
+    if (found != ringState.end()) {
+        GossipEntry &current = found->second;
+        if (entry.heartbeat < current.heartbeat
+            || (entry.heartbeat == current.heartbeat
+                && (entry.state == current.state || entry.state == MEMBER_ALIVE))) {
+            return false;
+        }
+        wasAlive = current.state == MEMBER_ALIVE;
+    }
+    ringState[key] = entry;
+
+    Address addr = makeAddress(entry.id, entry.port);
+    if (!wasAlive && entry.state == MEMBER_ALIVE) {
+        log->logNodeAdd(&memberNode->addr, &addr);
+        memberNode->addMembershipEvent(MEMBER_JOINED, addr);
+        ringChanged = true;
+    } else if (wasAlive && entry.state != MEMBER_ALIVE) {
+        log->logNodeRemove(&memberNode->addr, &addr);
+        memberNode->addMembershipEvent(MEMBER_LEFT, addr, entry.state == MEMBER_DEPARTED);
+        removePassive(key);
+        ringChanged = true;
+    }
+    return true;
+}
+
+/**
+ * FUNCTION NAME: floodRing
+ *
+ * DESCRIPTION: Send ring updates to every neighbour but the one they came from
+ */
+void MP1Node::floodRing(vector<GossipEntry> &entries, long exclude) {
+    for (unsigned int i = 0; i < memberNode->memberList.size(); i++) {
+        MemberListEntry peer = memberNode->memberList.at(i);
+        if (memberKey(peer.getid(), peer.getport()) != exclude) {
+            Address destination = makeAddress(peer.getid(), peer.getport());
+            sendGossipEntries(&destination, RING_UPDATE, entries);
+        }
+    }
+}
+
+/**
+ * FUNCTION NAME: collectRingEntries
+ *
+ * DESCRIPTION: Copy the whole ring state, failed members included, for a joiner or a sync
+ */
+void MP1Node::collectRingEntries(vector<GossipEntry> &entries) {
+    for (map<long, GossipEntry>::iterator it = ringState.begin(); it != ringState.end(); ++it) {
+        entries.push_back(it->second);
+    }
+}
+
+/**
+ * FUNCTION NAME: updateRingList
+ *
+ * DESCRIPTION: Rebuild the ring members handed to MP2Node after the ring state changed
+ */
+void MP1Node::updateRingList() {
+    if (!ringChanged) {
+        return;
+    }
+    memberNode->ringList.clear();
+    for (map<long, GossipEntry>::iterator it = ringState.begin(); it != ringState.end(); ++it) {
+        if (it->second.state == MEMBER_ALIVE) {
+            memberNode->ringList.push_back(makeAddress(it->second.id, it->second.port));
+        }
+    }
+    ringChanged = false;
+}
+
 /******************************************************************************
  *
  * Utility Functions
@@ -537,6 +1800,10 @@ void MP1Node::sendMemberTables()
  *
  *****************************************************************************/
 
+long MP1Node::memberKey(int id, short port) {
+    return ((long)id << 16) | (unsigned short)port;
+}
+
 Address MP1Node::makeAddress(int id, short port) {
     Address addr;
     memcpy(&addr.addr[0], &id, sizeof(int));
@@ -573,8 +1840,8 @@ void MP1Node::logMemberStatus() {
         //cout << "for node " << memberNode->addr.getAddress() << "==>" << endl;
         //cout << "heartbeat = " << memberNode->heartbeat << endl;
         //cout << "[";
-        for (vector<MemberListEntry>::iterator it = memberNode->memberList.begin(); it != memberNode->memberList.end(); it++) {
-            //cout << it->getid() << ":" << it->getheartbeat() << ":" << it->gettimestamp() << ",";
+        for (size_t i = 0; i < memberNode->memberList.size(); i++) {
+            //cout << memberNode->memberList.getid(i) << ":" << memberNode->memberList.getheartbeat(i) << ":" << memberNode->memberList.gettimestamp(i) << ",";
         }
         //cout << "]" << endl;
     }
@@ -14,6 +14,7 @@
 #include "Member.h"
 #include "EmulNet.h"
 #include "Queue.h"
+#include "PhiAccrual.h"
 
 /**
  * Macros
@@ -21,6 +22,41 @@
 #define TREMOVE 20
 #define TFAIL 5
 #define SPREAD_RATE 3
+#define FULL_SYNC_INTERVAL 10
+#define JOIN_RETRY_TIMEOUT 10
+
+/**
+ * SWIM macros, in ticks. A direct ping is answered two ticks after it is sent and an
+ * indirect one four ticks after, so SWIM_PERIOD covers the whole indirect round trip.
+ * A failed member is picked within 2N-1 periods by the round robin probe order and is
+ * confirmed SWIM_SUSPECT_TIMEOUT ticks later.
+ */
+#define SWIM_PERIOD 5
+#define SWIM_ACK_TIMEOUT 2
+#define SWIM_PING_REQ_MEMBERS 3
+#define SWIM_SUSPECT_TIMEOUT 10
+#define SWIM_MAX_PIGGYBACK 6
+#define SWIM_RETRANSMIT_MULT 3
+
+/**
+ * HyParView macros, in ticks and members. The active view is symmetric and every link
+ * carries a keepalive per tick, so a silent neighbour is dropped after TFAIL ticks.
+ * The link alone may have failed, so the dropped neighbour is probed with a neighbour
+ * request every HPV_NEIGHBOR_TIMEOUT, and only once HPV_DEATH_PROBES go unanswered is
+ * its failure flooded to the ring.
+ * Joins are spread by random walks of HPV_ACTIVE_RWL hops, and shuffles walk
+ * HPV_PASSIVE_RWL hops every HPV_SHUFFLE_PERIOD to refresh the passive view.
+ */
+#define HPV_ACTIVE_SIZE 5
+#define HPV_PASSIVE_SIZE 30
+#define HPV_ACTIVE_RWL 6
+#define HPV_PASSIVE_RWL 3
+#define HPV_SHUFFLE_PERIOD 10
+#define HPV_SHUFFLE_ACTIVE 3
+#define HPV_SHUFFLE_PASSIVE 4
+#define HPV_NEIGHBOR_TIMEOUT 4
+#define HPV_DEATH_PROBES 2
+#define HPV_RING_SYNC_PERIOD 50
 
 /*
  * Note: You can change/add any functions in MP1Node.{h,cpp}
@@ -33,20 +69,95 @@ enum MessageTypes{
     JOINREQ,
     JOINREP,
     MEMBER_TABLE,
+    PING,
+    ACK,
+    PING_REQ,
+    FORWARD_JOIN,
+    NEIGHBOR,
+    NEIGHBOR_REPLY,
+    DISCONNECT,
+    SHUFFLE,
+    SHUFFLE_REPLY,
+    KEEPALIVE,
+    RING_UPDATE,
+    LEAVE,
+};
+
+/**
+ * Member states carried by SWIM updates
+ */
+enum MemberStates{
+    MEMBER_ALIVE,
+    MEMBER_SUSPECT,
+    MEMBER_CONFIRMED,
+    MEMBER_DEPARTED,
 };
 
 /**
  * STRUCT NAME: MessageHeader
  *
- * DESCRIPTION: Header and content of a message
+ * DESCRIPTION: Header of a message. entryCount GossipEntry records
+ *              follow the header in the same frame.
  */
 typedef struct MembershipMessage {
     enum MessageTypes messageType;
     Address address;
+    // SWIM: member to probe for a PING_REQ, member to relay the ack to otherwise
+    // HyParView: joiner of a FORWARD_JOIN, origin of a SHUFFLE
+    Address target;
     long heartbeat;
-    vector<MemberListEntry> memberList;
+    // HyParView: hops left on a random walk, or 1 for a high priority NEIGHBOR
+    // request and an accepting NEIGHBOR_REPLY
+    int param;
+    int entryCount;
 } MembershipMessage ;
 
+/**
+ * STRUCT NAME: GossipEntry
+ *
+ * DESCRIPTION: One membership table entry as carried on the wire
+ */
+typedef struct GossipEntry {
+    int id;
+    short port;
+    unsigned char state;
+    long heartbeat;
+} GossipEntry;
+
+/**
+ * STRUCT NAME: GossipPeer
+ *
+ * DESCRIPTION: What has been sent to one gossip peer, so that only the
+ *              entries changed since then need to be sent again, and when
+ *              it was last answered in a push-pull round
+ */
+typedef struct GossipPeer {
+    int lastTold = -1;
+    int lastFullSync = -1;
+    int lastPulled = -1;
+} GossipPeer;
+
+/**
+ * STRUCT NAME: SwimMember
+ *
+ * DESCRIPTION: SWIM failure detector state of one member. Its incarnation number is
+ *              the heartbeat of its membership list entry.
+ */
+typedef struct SwimMember {
+    int state = MEMBER_ALIVE;
+    int suspectTime = 0;
+} SwimMember;
+
+/**
+ * STRUCT NAME: SwimUpdate
+ *
+ * DESCRIPTION: A membership update waiting to be piggybacked on SWIM messages
+ */
+typedef struct SwimUpdate {
+    GossipEntry entry;
+    int transmitsLeft;
+} SwimUpdate;
+
 /**
  * CLASS NAME: MP1Node
  *
@@ -59,6 +170,42 @@ private:
 	Params *par;
 	Member *memberNode;
 	char NULLADDR[6];
+	// per peer delta gossip state, keyed by memberKey(), dropped with the member
+	map<long, GossipPeer> gossipPeers;
+	// heartbeat of each member at its graceful leave, so stale gossip cannot bring it back
+	map<long, long> departedMembers;
+	// heartbeat arrivals seen for each member, used with PHI_ACCRUAL_DETECTOR
+	PhiAccrual detector;
+	// gossip volume sent by this node
+	long gossipFramesSent;
+	long gossipEntriesSent;
+	long gossipBytesSent;
+	// SWIM state, keyed by memberKey()
+	map<long, SwimMember> swimMembers;
+	map<long, long> swimConfirmed;
+	vector<SwimUpdate> swimUpdates;
+	vector<long> probeOrder;
+	size_t probeIndex;
+	long probeKey;
+	int probeStart;
+	bool probeAcked;
+	bool pingReqSent;
+	int nextProbeTime;
+	// HyParView state. The active view is memberList, the passive view and the
+	// ring state are keyed by memberKey()
+	vector<long> passiveView;
+	map<long, GossipEntry> ringState;
+	bool ringChanged;
+	long pendingNeighbor;
+	int neighborStart;
+	// dropped neighbours being probed before their failure is flooded, and when
+	// they were dropped
+	map<long, int> suspects;
+	int nextShuffleTime;
+	int nextRingSyncTime;
+	// join attempts made so far and when the last one was sent
+	int joinAttempts;
+	int joinStart;
 
 public:
 	MP1Node(Member *, Params *, EmulNet *, Log *, Address *);
@@ -71,21 +218,65 @@ public:
 	int initThisNode(Address *joinaddr);
 	int introduceSelfToGroup(Address *joinAddress);
 	int finishUpThisNode();
+	int leaveGroup();
 	void nodeLoop();
 	void checkMessages();
 	bool recvCallBack(void *env, char *data, int size);
 	void nodeLoopOps();
 	int isNullAddress(Address *addr);
 	Address getJoinAddress();
+	Address getIntroducerAddress(int attempt);
     void initMemberListTable(Member *memberNode, int id, short port);
 	void printAddress(Address *addr);
 	virtual ~MP1Node();
     void handleJoinRequest(MembershipMessage *message);
     void handleJoinReply(MembershipMessage *message);
     void handleMemberTable(MembershipMessage *message);
+    void handleLeave(MembershipMessage *message);
     void logMemberStatus();
     void updateMemberList(int id, short port, long heartbeat);
     void sendMemberTables();
+    int gossipFanout(int groupSize);
+    bool toldOverKV(Address &peer);
+    void collectGossipEntries(long peerKey, vector<GossipEntry> &entries);
+    void sendGossipEntries(Address *destination, enum MessageTypes type, vector<GossipEntry> &entries,
+                           Address *target = NULL, int param = 0);
+    void logGossipStats();
+    long memberKey(int id, short port);
+    int findMember(int id, short port);
+    void removeMember(int id, short port, bool graceful);
+    bool hasFailed(size_t i);
+    void removeExpired(vector<size_t> &expired);
+    void swimLoopOps();
+    void handlePing(MembershipMessage *message);
+    void handleAck(MembershipMessage *message);
+    void handlePingReq(MembershipMessage *message);
+    void sendSwimMessage(Address *destination, enum MessageTypes type, Address *target);
+    void applySwimUpdates(MembershipMessage *message);
+    void applySwimUpdate(GossipEntry &update);
+    void queueSwimUpdate(int id, short port, long incarnation, int state);
+    void suspectMember(long key);
+    void confirmMember(int id, short port, long incarnation, int state);
+    long nextProbeTarget();
+    void hpvLoopOps();
+    void handleForwardJoin(MembershipMessage *message);
+    void handleNeighbor(MembershipMessage *message);
+    void handleNeighborReply(MembershipMessage *message);
+    void handleDisconnect(MembershipMessage *message);
+    void handleShuffle(MembershipMessage *message);
+    void handleShuffleReply(MembershipMessage *message);
+    void handleKeepalive(MembershipMessage *message);
+    void handleRingUpdate(MembershipMessage *message);
+    bool addActive(int id, short port);
+    void removeActive(int id, short port);
+    void addPassive(int id, short port);
+    void removePassive(long key);
+    void mergePassive(MembershipMessage *message);
+    long randomActive(long exclude, long alsoExclude);
+    bool applyRingEntry(GossipEntry &entry);
+    void floodRing(vector<GossipEntry> &entries, long exclude);
+    void collectRingEntries(vector<GossipEntry> &entries);
+    void updateRingList();
     Address makeAddress(int id, short port);
     int getMyId();
     short getMyPort();
@@ -6,6 +6,11 @@
 #include "MP2Node.h"
 #include <sstream>
 
+/**
+ * Ring snapshots shared by the nodes
+ */
+map<string, weak_ptr<const MP2Node::RingSnapshot> > MP2Node::ringSnapshots;
+
 /**
  * constructor
  */
@@ -17,6 +22,32 @@ MP2Node::MP2Node(Member *memberNode, Params *par, EmulNet * emulNet, Log * log,
     kvsHashTable = new HashTable();
     this->memberNode->addr = *address;
     initialized = 0;
+    ringVersion = -1;
+    requestsServed = 0;
+    nextStreamId = 0;
+    chunksStreamed = 0;
+    peakChunksPerTick = 0;
+    antiEntropyRounds = 0;
+    antiEntropyMessages = 0;
+    keysRepaired = 0;
+    nextHintId = 0;
+    hintsStored = 0;
+    hintsDelivered = 0;
+    ringUnsettled = false;
+    lastRingChange = 0;
+    unsettledGracefulOnly = true;
+    ringChanges = 0;
+    stabilizationRuns = 0;
+    readQuorums = 0;
+    readQuorumTicks = 0;
+    writeQuorums = 0;
+    writeQuorumTicks = 0;
+    readsHedged = 0;
+    crossZoneMessages = 0;
+    partitioner = makePartitioner(par->PARTITIONER, par->NUM_ZONES);
+    snapshotsBuilt = 0;
+    snapshotsShared = 0;
+    snapshot = internSnapshot(set<string>());
 }
 
 /**
@@ -26,6 +57,7 @@ MP2Node::MP2Node(Member *memberNode, Params *par, EmulNet * emulNet, Log * log,
 MP2Node::~MP2Node() {
     delete kvsHashTable;
     delete memberNode;
+    delete partitioner;
 }
 
 /**
@@ -34,51 +66,247 @@ MP2Node::~MP2Node() {
  * DESCRIPTION: This function does the following:
  * 				1) Gets the current membership list from the Membership Protocol (MP1Node)
  * 				   The membership list is returned as a vector of Nodes. See Node class in Node.h
- * 				2) Constructs the ring based on the membership list
+ * 				2) Constructs the ring based on the membership list, or shares the snapshot
+ * 				   already built for the same members by another node
  * 				3) Checks for changes in the ring, and if there are, calls the stabilization protocol
+ * 				Nothing is done while the membership version stands still, and the membership
+ * 				events since the last version are applied to the ring when they are all at hand.
+ * 				Requests use the new ring at once, but stabilization waits for the ring to
+ * 				settle, so a burst of changes is stabilized once.
  */
 void MP2Node::updateRing() {
 
-    vector<Node> currentMembersList;
+    if (memberNode->membershipVersion == ringVersion) {
+        settleRing();
+        return;
+    }
 
-    currentMembersList = getMembershipList();
-    // Sort the list based on the hashCode
-    sort(currentMembersList.begin(), currentMembersList.end());
+    set<string> members = snapshot->table.members;
+    bool gracefulOnly = false;
 
+    if (members.empty() || !applyMembershipEvents(members, gracefulOnly)) {
+        members.clear();
+        getMembershipList(members);
+        gracefulOnly = false;
+    }
+    ringVersion = memberNode->membershipVersion;
 
-    if ( ring.size() == 0 ){
-        ring=currentMembersList;
+    shared_ptr<const RingSnapshot> next = internSnapshot(members);
+    if (next == snapshot) {
+        settleRing();
         return;
     }
 
-    if (currentMembersList.size() != ring.size()){
-        stabilizationProtocol();
+    if (!snapshot->ring.empty()) {
+        if (!ringUnsettled) {
+            unsettledSnapshot = snapshot;
+            ringUnsettled = true;
+            unsettledGracefulOnly = true;
+        }
+        unsettledGracefulOnly = unsettledGracefulOnly && gracefulOnly;
+        lastRingChange = par->getcurrtime();
+        ringChanges += gracefulOnly ? 0 : 1;
+    }
+
+    snapshot = next;
+    rebuildMerkle();
+    settleRing();
+
+}
+
+/**
+ * FUNCTION NAME: internSnapshot
+ *
+ * DESCRIPTION: The snapshot of the ring of the given members. Nodes that see the same
+ * 				members get the same snapshot, so a ring is sorted and compiled once for
+ * 				each view, by the first node to reach it. A snapshot goes once no node
+ * 				uses it any more.
+ */
+shared_ptr<const MP2Node::RingSnapshot> MP2Node::internSnapshot(const set<string> &members) {
+    string view;
+    for (set<string>::const_iterator it = members.begin(); it != members.end(); it++) {
+        view += *it;
+    }
+    map<string, weak_ptr<const RingSnapshot> >::iterator found = ringSnapshots.find(view);
+    if (found != ringSnapshots.end()) {
+        shared_ptr<const RingSnapshot> shared = found->second.lock();
+        if (shared) {
+            snapshotsShared++;
+            return shared;
+        }
+    }
+
+    shared_ptr<RingSnapshot> built = make_shared<RingSnapshot>();
+    for (set<string>::const_iterator it = members.begin(); it != members.end(); it++) {
+        Address address;
+        memcpy(address.addr, it->data(), sizeof(address.addr));
+        addTokens(built->ring, address);
+    }
+    sort(built->ring.begin(), built->ring.end());
+    buildReplicaTable(built->ring, built->table);
+    snapshotsBuilt++;
+
+    //forget the views no node is on any more
+    for (map<string, weak_ptr<const RingSnapshot> >::iterator it = ringSnapshots.begin(); it != ringSnapshots.end();) {
+        if (it->second.expired()) {
+            it = ringSnapshots.erase(it);
+        } else {
+            it++;
+        }
+    }
+    ringSnapshots[view] = built;
+    return built;
+}
+
+/**
+ * FUNCTION NAME: boundReplicaLoads
+ *
+ * DESCRIPTION: Consistent hashing with bounded loads. No node replicates more than
+ * 				LOAD_BOUND percent over the mean share of the ring. The arcs between tokens
+ * 				are swept in ring order, and each goes to the first three distinct nodes,
+ * 				from its own token on, that still have room. An arc is split where one of
+ * 				them fills up, and the rest goes on to the next nodes with room. Only when
+ * 				fewer than three nodes have room left does a node go over its bound. The
+ * 				table ends up with a token at the end of every piece.
+ */
+void MP2Node::boundReplicaLoads(vector<Node> &ringNodes, ReplicaTable &table) {
+    size_t n = ringNodes.size();
+    long double capacity = (1 + par->LOAD_BOUND / 100.0L) * 3 * 18446744073709551616.0L / table.members.size();
+    map<string, long double> room;
+    for (set<string>::iterator it = table.members.begin(); it != table.members.end(); it++) {
+        room[*it] = capacity;
+    }
+
+    vector<pair<uint64_t, vector<Node> > > pieces;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t start = ringNodes[(i + n - 1) % n].getHashCode();
+        uint64_t left = ringNodes[i].getHashCode() - start;
+        while (left > 0) {
+            vector<Node> replicas;
+            vector<string> picked;
+            long double take = left;
+            for (int pass = 0; pass < 2; pass++) {
+                for (size_t j = i; replicas.size() < 3 && j < i + n; j++) {
+                    Address *candidate = ringNodes[j % n].getAddress();
+                    string addr(candidate->addr, sizeof(candidate->addr));
+                    //the first pass takes nodes with room, the second any node left
+                    if ((pass == 0 && room[addr] <= 0) || find(picked.begin(), picked.end(), addr) != picked.end()) {
+                        continue;
+                    }
+                    replicas.push_back(ringNodes[j % n]);
+                    picked.push_back(addr);
+                    if (pass == 0) {
+                        take = min(take, room[addr]);
+                    }
+                }
+            }
+            uint64_t step = take >= left ? left : max((uint64_t)1, (uint64_t)take);
+            for (size_t k = 0; k < picked.size(); k++) {
+                room[picked[k]] -= step;
+            }
+            start += step;
+            left -= step;
+            pieces.push_back(make_pair(start, replicas));
+        }
+    }
+
+    sort(pieces.begin(), pieces.end(), [](const pair<uint64_t, vector<Node> > &a, const pair<uint64_t, vector<Node> > &b) {
+        return a.first < b.first;
+    });
+    table.replicaSets.clear();
+    for (size_t i = 0; i < pieces.size(); i++) {
+        table.tokens.push_back(pieces[i].first);
+        table.replicaSets.push_back(pieces[i].second);
     }
+}
 
-    ring=currentMembersList;
+/**
+ * FUNCTION NAME: settleRing
+ *
+ * DESCRIPTION: Once the ring has gone RING_SETTLE ticks without a change, run the
+ * 				stabilization protocol once for the net change since it was last settled.
+ * 				Nothing moves if the ring is back to the members it had, or if every change
+ * 				was a graceful leave, as those members have already handed their keys off.
+ * 				The members, not the tokens, tell: the slice partitioners keep the same
+ * 				tokens when one node takes another's place.
+ */
+void MP2Node::settleRing() {
+    if (!ringUnsettled || par->getcurrtime() - lastRingChange < par->RING_SETTLE) {
+        return;
+    }
+    ringUnsettled = false;
+    if (!unsettledGracefulOnly && unsettledSnapshot->table.members != snapshot->table.members) {
+        stabilizationProtocol(unsettledSnapshot, snapshot);
+        stabilizationRuns++;
+    }
+    unsettledSnapshot.reset();
+}
 
+/**
+ * FUNCTION NAME: applyMembershipEvents
+ *
+ * DESCRIPTION: Insert and remove the members that joined and left since ringVersion.
+ * 				Returns false if some of those events were already dropped.
+ * 				gracefulOnly tells whether all of the events were graceful leaves.
+ */
+bool MP2Node::applyMembershipEvents(set<string> &members, bool &gracefulOnly) {
+    deque<MembershipEvent> &events = memberNode->membershipEvents;
+    if (events.empty() || events.front().version > ringVersion + 1) {
+        return false;
+    }
+    gracefulOnly = true;
+
+    //the versions are consecutive, so the first new event is found by its version. A member
+    //that left and joined again within the batch just stays on the ring
+    set<string> left;
+    for (size_t i = ringVersion + 1 - events.front().version; i < events.size(); i++) {
+        string addr(events[i].addr.addr, sizeof(events[i].addr.addr));
+        gracefulOnly = gracefulOnly && events[i].graceful;
+        if (events[i].type == MEMBER_LEFT) {
+            left.insert(addr);
+        } else if (left.erase(addr) == 0) {
+            members.insert(addr);
+        }
+    }
+    for (set<string>::iterator it = left.begin(); it != left.end(); it++) {
+        members.erase(*it);
+    }
+    return true;
 }
 
 /**
  * FUNCTION NAME: getMemberhipList
  *
  * DESCRIPTION: This function goes through the membership list from the Membership protocol/MP1 and
- * 				i) generates the hash code for each member
- * 				ii) populates the ring member in MP2Node class
- * 				It returns a vector of Nodes. Each element in the vector contain the following fields:
- * 				a) Address of the node
- * 				b) Hash code obtained by consistent hashing of the Address
- */
-vector<Node> MP2Node::getMembershipList() {
-    vector<Node> curMemList;
+ * 				collects the addresses of the members, from which the ring is built
+ */
+void MP2Node::getMembershipList(set<string> &members) {
+    if (par->MEMBERSHIP_MODE == HYPARVIEW_MEMBERSHIP) {
+        //partial views only know a few members, the ring state is kept apart
+        for ( auto i = 0 ; i < (int)(this->memberNode->ringList.size()); i++ ) {
+            Address &addressOfThisMember = this->memberNode->ringList.at(i);
+            members.insert(string(addressOfThisMember.addr, sizeof(addressOfThisMember.addr)));
+        }
+        return;
+    }
     for ( auto i = 0 ; i < (int)(this->memberNode->memberList.size()); i++ ) {
         Address addressOfThisMember;
         int id = this->memberNode->memberList.at(i).getid();
         short port = this->memberNode->memberList.at(i).getport();
         addressOfThisMember = makeAddress(id, port);
-        curMemList.emplace_back(Node(addressOfThisMember));
+        members.insert(string(addressOfThisMember.addr, sizeof(addressOfThisMember.addr)));
+    }
+}
+
+/**
+ * FUNCTION NAME: addTokens
+ *
+ * DESCRIPTION: Append the VNODES tokens of the node at the given address to a ring
+ */
+void MP2Node::addTokens(vector<Node> &ringNodes, Address &address) {
+    for (int token = 0; token < max(par->VNODES, 1); token++) {
+        ringNodes.emplace_back(Node(address, token));
     }
-    return curMemList;
 }
 
 /**
@@ -88,12 +316,10 @@ vector<Node> MP2Node::getMembershipList() {
  * 				HASH FUNCTION USED FOR CONSISTENT HASHING
  *
  * RETURNS:
- * size_t position on the ring
+ * uint64_t position on the 2^64 ring
  */
-size_t MP2Node::hashFunction(string key) {
-    std::hash<string> hashFunc;
-    size_t ret = hashFunc(key);
-    return ret % RING_SIZE;
+uint64_t MP2Node::hashFunction(const string &key) {
+    return stableHash(key);
 }
 
 /**
@@ -111,32 +337,42 @@ void MP2Node::clientCreate(string key, string value) {
     //Get the vector which contains the three nodes where the key will map to
     //Create a message and send it to the respective node
 
-    vector<Node> replicaNodes = findNodes(key);
+    const vector<Node> &replicaNodes = findNodes(key);
 
 
     long tID = addTransaction(key, value, CREATE);
     Transaction t = transactions[tID];
+
+    //the ring is not big enough to hold three replicas yet
+    if (replicaNodes.size() < 3) {
+        log->logCreateFail(&memberNode->addr, true, tID, key, value);
+        transactions[tID].complete = true;
+        return;
+    }
     //New Primary Node
         Message msg(tID, memberNode->addr, CREATE, key, value, PRIMARY);
-        emulNet->ENsend(&memberNode->addr, replicaNodes[0].getAddress(), msg.toString());
+        sendMessage(replicaNodes[0].getAddress(), msg);
         string s = "PRIMARY create to " + replicaNodes[0].getAddress()->getAddress();
         //trace("clientCreate",tID, memberNode->addr,key, value, s);
 
     //new secondary node
         Message msg2(tID, memberNode->addr, CREATE, key, value, SECONDARY);
-        emulNet->ENsend(&memberNode->addr, replicaNodes[1].getAddress(), msg2.toString());
+        sendMessage(replicaNodes[1].getAddress(), msg2);
         s = "SECONDARY create to " + replicaNodes[0].getAddress()->getAddress();
         //trace("clientCreate",tID, memberNode->addr,key, value, s);
 
 
     //new tertiary node
         Message msg3(tID, memberNode->addr, CREATE, key, value, TERTIARY);
-        emulNet->ENsend(&memberNode->addr, replicaNodes[2].getAddress(), msg3.toString());
+        sendMessage(replicaNodes[2].getAddress(), msg3);
         s = "TERTIARY create to " + replicaNodes[0].getAddress()->getAddress();
         //trace("clientCreate",tID, memberNode->addr,key, value, s);
 
 
     //update the transaction list
+    for (size_t i = 0; i < 3; i++) {
+        t.replicas.push_back(*replicaNodes[i].getAddress());
+    }
     transactions[tID] = t;
 }
 
@@ -159,9 +395,28 @@ void MP2Node::clientRead(string key){
     Transaction t = transactions[tID];
     string value = "";
 
+    //when two replicas share the zone of this node they alone can make a quorum, and the
+    //replica in another zone is held back until they fall short or miss a round trip
+    if (par->NUM_ZONES > 1 && replicas.size() == 3) {
+        int zone = memberNode->addr.getZone(par->NUM_ZONES);
+        size_t nearby = 0, farthest = 0;
+        for (size_t i = 0; i < replicas.size(); i++) {
+            if (replicas[i].getAddress()->getZone(par->NUM_ZONES) == zone) {
+                nearby++;
+            } else {
+                farthest = i;
+            }
+        }
+        if (nearby == 2) {
+            t.deferred.push_back(*replicas[farthest].getAddress());
+            replicas.erase(replicas.begin() + farthest);
+            t.hedgeAt = t.time + roundTrip(&memberNode->addr);
+        }
+    }
+
     for(auto i = 0; i<(int)replicas.size(); i++){
         Message msg(tID, memberNode->addr, READ, key);
-        emulNet->ENsend(&memberNode->addr, replicas[i].getAddress(), msg.toString());
+        sendMessage(replicas[i].getAddress(), msg);
         Node thisNode = replicas[i];
         Address fromAddr  = *(thisNode.getAddress());
         string sFromAddr = fromAddr.getAddress();
@@ -186,7 +441,7 @@ void MP2Node::clientUpdate(string key, string value){
     long tID = addTransaction(key, value, UPDATE);
     string fName = "client update";
 
-    vector<Node> replicas = findNodes(key);
+    const vector<Node> &replicas = findNodes(key);
     if(replicas.size() == 0){
         log->logUpdateFail(&memberNode->addr, true, tID, key, value);
         trace("clientUpdate",tID, memberNode->addr,key, value, "update fail");
@@ -195,11 +450,12 @@ void MP2Node::clientUpdate(string key, string value){
 
     for(auto i = 0; i<(int)replicas.size(); i++){
             Message msg(tID, memberNode->addr, UPDATE, key, value);
-            emulNet->ENsend(&memberNode->addr, replicas[i].getAddress(), msg.toString());
+            sendMessage(replicas[i].getAddress(), msg);
             Node n = replicas[i];
             Address a = *(n.getAddress());
             string s = "sending update to " + a.getAddress();
             trace("clientUpdate",tID, memberNode->addr,key, value, s);
+            transactions[tID].replicas.push_back(a);
 
         }
     }
@@ -218,7 +474,7 @@ void MP2Node::clientDelete(string key){
      * Implement this
      */
 
-    vector<Node>  replicas = findNodes(key);
+    const vector<Node> &replicas = findNodes(key);
 
     long tID = addTransaction(key, "", DELETE);
     Transaction t = transactions[tID];
@@ -226,7 +482,8 @@ void MP2Node::clientDelete(string key){
     for(auto i = 0; i<(int)replicas.size(); i++){
 
         Message msg(g_transID, memberNode->addr, DELETE, key);
-        emulNet->ENsend(&memberNode->addr, replicas[i].getAddress(), msg.toString());
+        sendMessage(replicas[i].getAddress(), msg);
+        t.replicas.push_back(*replicas[i].getAddress());
     }
     transactions[tID] = t;
 }
@@ -251,7 +508,8 @@ bool MP2Node::updateKeyValue(string key, string value, ReplicaType replica) {
     }
     else{
 
-        return kvsHashTable->update(key, value);
+        storeKey(key, value, par->getcurrtime());
+        return true;
 
     }
 
@@ -288,6 +546,11 @@ void MP2Node::checkMessages() {
          */
 
         Message incomingMessage(message);  
+        memberNode->kvDigests.insert(memberNode->kvDigests.end(), incomingMessage.digest.begin(), incomingMessage.digest.end());
+        if (incomingMessage.type == CREATE || incomingMessage.type == READ ||
+            incomingMessage.type == UPDATE || incomingMessage.type == DELETE) {
+            requestsServed++;
+        }
         long tID = incomingMessage.transID;
         string fName = "checkMessages";
         string fromAddress = incomingMessage.fromAddr.getAddress();
@@ -332,9 +595,44 @@ void MP2Node::checkMessages() {
             //trace(fName,tID,node,blank ,blank,s);
         }
 
+        //Handle the keys handed off by a node that is leaving
+        else if(incomingMessage.type == HANDOFF){
+            handoffMessageHandler(incomingMessage);
+        }
+
+        //Handle a chunk of a key stream, and the ack of a chunk this node streamed
+        else if(incomingMessage.type == STREAM){
+            streamMessageHandler(incomingMessage);
+        }
+        else if(incomingMessage.type == STREAM_ACK){
+            streamAckMessageHandler(incomingMessage);
+        }
+
+        //Handle a step of a Merkle tree comparison, and the records it repairs
+        else if(incomingMessage.type == MERKLE){
+            merkleMessageHandler(incomingMessage);
+        }
+        else if(incomingMessage.type == REPAIR){
+            repairMessageHandler(incomingMessage);
+        }
+
+        //Handle the writes this node missed, replayed by their coordinator, and their acks
+        else if(incomingMessage.type == HINT){
+            hintMessageHandler(incomingMessage);
+        }
+        else if(incomingMessage.type == HINT_ACK){
+            hintAckMessageHandler(incomingMessage);
+        }
+
         //Handle a reply message
         else if(incomingMessage.type == REPLY){
 
+            //remember the replicas that took a write, for the hints of the rest
+            map<long, Transaction>::iterator acked = transactions.find(tID);
+            if (acked != transactions.end() && incomingMessage.success) {
+                acked->second.acked.insert(fromAddress);
+            }
+
             if (bTransactionComplete == false) {
 
                 MessageType type = transactions[tID].type;
@@ -370,9 +668,31 @@ void MP2Node::checkMessages() {
                 trace(fName,tID,node,blank ,blank,s);
             }
         }
+
+        //the ticks a quorum took, for the stats
+        if (!bTransactionComplete && (incomingMessage.type == REPLY || incomingMessage.type == READREPLY)) {
+            map<long, Transaction>::iterator done = transactions.find(tID);
+            if (done != transactions.end() && done->second.complete) {
+                if (done->second.type == READ) {
+                    readQuorums++;
+                    readQuorumTicks += par->getcurrtime() - done->second.time;
+                } else {
+                    writeQuorums++;
+                    writeQuorumTicks += par->getcurrtime() - done->second.time;
+                }
+            }
+        }
     }
     //Timeout on requests that you have been waiting too long on
     cleanUpTransactions();
+    //Ask the held back replica of reads still waiting on the nearest ones
+    hedgeReads();
+    //Resend stalled key streams and send this tick's rebalance chunks
+    advanceStreams();
+    //Compare Merkle trees with a co-replica
+    runAntiEntropy();
+    //Replay the writes replicas missed
+    replayHints();
 }
 
 
@@ -392,7 +712,8 @@ void MP2Node::cleanUpTransactions() {
         long transactionID = it->first;
         Transaction t = it->second;
 
-        if((par->getcurrtime() - t.time) > 5){
+        //replies from other zones take longer to come back
+        if((par->getcurrtime() - t.time) > 5 + 2 * par->ZONE_LATENCY){
 
 
             //erase completed messages
@@ -422,6 +743,12 @@ void MP2Node::cleanUpTransactions() {
                 }
             }
 
+            //replicas that missed a write a quorum took get it later as a hint. A write that
+            //failed is not replayed, even onto the replicas that did not take it
+            if (t.type != READ && t.acked.size() >= 2) {
+                storeHints(t);
+            }
+
             //We will clear the associated elements from the map
             //note - ned to increment the iterator otherwise it won't work
             it = transactions.erase(it);
@@ -435,6 +762,46 @@ void MP2Node::cleanUpTransactions() {
 
 }
 
+/**
+ * FUNCTION NAME: roundTrip
+ *
+ * DESCRIPTION: The ticks from sending a request to a peer to getting its reply, longer
+ * 				when the peer is in another zone
+ */
+int MP2Node::roundTrip(Address *peer) {
+    bool crossZone = memberNode->addr.getZone(par->NUM_ZONES) != peer->getZone(par->NUM_ZONES);
+    return 2 + (crossZone ? 2 * par->ZONE_LATENCY : 0);
+}
+
+/**
+ * FUNCTION NAME: askDeferred
+ *
+ * DESCRIPTION: Send a read to the replicas it held back
+ */
+void MP2Node::askDeferred(long transID, Transaction &t) {
+    for (size_t i = 0; i < t.deferred.size(); i++) {
+        Message msg(transID, memberNode->addr, READ, t.key);
+        sendMessage(&t.deferred[i], msg);
+    }
+    t.deferred.clear();
+    readsHedged++;
+}
+
+/**
+ * FUNCTION NAME: hedgeReads
+ *
+ * DESCRIPTION: Ask the held back replica of every read whose nearest replicas have not
+ * 				made a quorum within a round trip
+ */
+void MP2Node::hedgeReads() {
+    for (map<long, Transaction>::iterator it = transactions.begin(); it != transactions.end(); it++) {
+        Transaction &t = it->second;
+        if (t.type == READ && !t.complete && !t.deferred.empty() && par->getcurrtime() >= t.hedgeAt) {
+            askDeferred(it->first, t);
+        }
+    }
+}
+
 /*
 *   FUNCTION: readReplyMessageHandler
 *
@@ -489,6 +856,11 @@ void MP2Node::readReplyMessageHandler(Message incomingMessage){
         }
     }
 
+    //a failed or disagreeing reply needs the replica held back
+    if (!t.complete && !t.deferred.empty() && (t.failures > 0 || t.count >= 2)) {
+        askDeferred(tID, t);
+    }
+
     transactions[incomingMessage.transID] = t;
 }
 
@@ -634,7 +1006,7 @@ void MP2Node::updateMessagehandler(Message incomingMessage){
 
     //send the message reply
     Message msg(incomingMessage.transID, memberNode->addr, REPLY, retVal);
-    emulNet->ENsend(&memberNode->addr, &fromAddr, msg.toString());
+    sendMessage(&fromAddr, msg);
 }
 
 
@@ -650,10 +1022,10 @@ void MP2Node::deleteMessagehandler(Message incomingMessage){
     Address fromAddr =  incomingMessage.fromAddr;
     string key = incomingMessage.key;
 
-    bool retVal = kvsHashTable->deleteKey(key);
+    bool retVal = removeKey(key, par->getcurrtime());
 
     Message msg(incomingMessage.transID, memberNode->addr, REPLY, retVal);
-    emulNet->ENsend(&memberNode->addr, &fromAddr, msg.toString());
+    sendMessage(&fromAddr, msg);
 
 }
 
@@ -678,14 +1050,14 @@ void MP2Node::readMessagehandler(Message incomingMessage){
     //The key was found, Log success and send the message
     if(value != ""){
         Message msg(incomingMessage.transID, memberNode->addr, value);
-        emulNet->ENsend(&memberNode->addr, &fromAddr, msg.toString());
+        sendMessage(&fromAddr, msg);
         log->logReadSuccess(&memberNode->addr, false, incomingMessage.transID, key, value);        
         trace("readMessagHandler",tID, memberNode->addr,key,value,"read success - key found at node");
     }
     //A key was not found, Log failure and send the message
     else{
         Message msg(incomingMessage.transID, memberNode->addr, "_");
-        emulNet->ENsend(&memberNode->addr, &fromAddr, msg.toString());
+        sendMessage(&fromAddr, msg);
         log->logReadFail(&memberNode->addr, false, incomingMessage.transID, key);
         trace("readMessagHandler",tID, memberNode->addr,key,value,"read fail - key not found");
     }
@@ -701,13 +1073,16 @@ void MP2Node::createMessageHandler(Message incomingMessage){
     string key = incomingMessage.key;
     string value = incomingMessage.value;
 
-    //Create a KeyValue
-    bool retVal = kvsHashTable->create(key, value);
+    //Create a KeyValue, unless it is already here
+    if (kvsHashTable->count(key) == 0) {
+        storeKey(key, value, par->getcurrtime());
+    }
+    bool retVal = true;
 
 
     //Create and send the message
     Message msg(incomingMessage.transID, memberNode->addr, REPLY, retVal);
-    emulNet->ENsend(&memberNode->addr, &fromAddr, msg.toString());
+    sendMessage(&fromAddr, msg);
 
     //log yet another successful operation
     log->logCreateSuccess(&memberNode->addr, true, incomingMessage.transID, key, value);
@@ -719,32 +1094,116 @@ void MP2Node::createMessageHandler(Message incomingMessage){
  *
  * DESCRIPTION: Find the replicas of the given keyfunction
  * 				This function is responsible for finding the replicas of a key
- * returns a vector with PRIMARY, SECONDARY, AND TERTIARY
- */
-vector<Node> MP2Node::findNodes(string key) {
-    size_t pos = hashFunction(key);
-    vector<Node> addr_vec;
-    if (ring.size() >= 3) {
-        // if pos <= min || pos > max, the leader is the min
-        if (pos <= ring.at(0).getHashCode() || pos > ring.at(ring.size()-1).getHashCode()) {
-            addr_vec.emplace_back(ring.at(0));
-            addr_vec.emplace_back(ring.at(1));
-            addr_vec.emplace_back(ring.at(2));
+ * returns a vector with PRIMARY, SECONDARY, AND TERTIARY, or an empty one while the ring
+ * is too small. The vector belongs to the replica table and is replaced with the ring.
+ */
+const vector<Node> &MP2Node::findNodes(const string &key) {
+    return findNodes(key, snapshot->table);
+}
+
+/**
+ * FUNCTION NAME: findNodes
+ *
+ * DESCRIPTION: Find the replicas of the given key in the given replica table
+ */
+const vector<Node> &MP2Node::findNodes(const string &key, const ReplicaTable &table) {
+    return findNodesAt(hashFunction(key), table);
+}
+
+/**
+ * FUNCTION NAME: findNodesAt
+ *
+ * DESCRIPTION: Find the replicas of a ring position in the given replica table. The
+ * 				bucket of the position gives the first token to look at, and only the
+ * 				tokens sharing that bucket are searched.
+ */
+const vector<Node> &MP2Node::findNodesAt(uint64_t position, const ReplicaTable &table) {
+    if (table.tokens.empty()) {
+        return table.replicaSets[0];
+    }
+    return table.replicaSets[tokenIndexAt(position, table)];
+}
+
+/**
+ * FUNCTION NAME: tokenIndexAt
+ *
+ * DESCRIPTION: The index of the first token at or past a ring position, wrapping around
+ * 				to the first token. The table must have tokens.
+ */
+size_t MP2Node::tokenIndexAt(uint64_t position, const ReplicaTable &table) {
+    size_t b = position >> RING_BUCKET_SHIFT;
+    size_t last = b + 1 < RING_SIZE ? table.bucket[b + 1] : table.tokens.size();
+    size_t i = lower_bound(table.tokens.begin() + table.bucket[b], table.tokens.begin() + last, position) - table.tokens.begin();
+    return i < table.tokens.size() ? i : 0;
+}
+
+/**
+ * FUNCTION NAME: buildReplicaTable
+ *
+ * DESCRIPTION: Compile a ring sorted by hash code into the replicas of every ring position.
+ * 				The partitioner picked by PARTITIONER splits the ring into ranges and places
+ * 				each on its replicas, and the ranges become the tokens of the table. With
+ * 				LOAD_BOUND the ring partitioner's replicas are placed with bounded loads.
+ */
+void MP2Node::buildReplicaTable(vector<Node> &ringNodes, ReplicaTable &table) {
+    table.tokens.clear();
+    table.bucket.assign(RING_SIZE, 0);
+    table.replicaSets.clear();
+    table.members.clear();
+    for (size_t i = 0; i < ringNodes.size(); i++) {
+        table.members.insert(string(ringNodes[i].getAddress()->addr, sizeof(ringNodes[i].getAddress()->addr)));
+    }
+    if (table.members.size() < 3) {
+        table.replicaSets.resize(1);
+        return;
+    }
+
+    if (par->PARTITIONER == RING_PARTITIONER && par->LOAD_BOUND > 0 && table.members.size() > 3) {
+        boundReplicaLoads(ringNodes, table);
+    } else {
+        partitioner->setNodes(ringNodes);
+        partitioner->ranges(table.tokens, table.replicaSets);
+    }
+    size_t token = 0;
+    for (size_t b = 0; b < RING_SIZE; b++) {
+        uint64_t start = (uint64_t)b << RING_BUCKET_SHIFT;
+        while (token < table.tokens.size() && table.tokens[token] < start) {
+            token++;
         }
-        else {
-            // go through the ring until pos <= node
-            for (auto i=1; i<(int)ring.size(); i++){
-                Node addr = ring.at(i);
-                if (pos <= addr.getHashCode()) {
-                    addr_vec.emplace_back(addr);
-                    addr_vec.emplace_back(ring.at((i+1)%ring.size()));
-                    addr_vec.emplace_back(ring.at((i+2)%ring.size()));
-                    break;
-                }
-            }
+        table.bucket[b] = token;
+    }
+}
+
+/**
+ * FUNCTION NAME: sendMessage
+ *
+ * DESCRIPTION: Send a message to another node. With PIGGYBACK_GOSSIP the message carries
+ * 				the PIGGYBACK_ENTRIES most recently updated membership entries, this node's
+ * 				own heartbeat first, and every peer given a digest this way saves the
+ * 				membership protocol one gossip frame.
+ */
+void MP2Node::sendMessage(const Address *toAddr, Message &message) {
+    if (par->PIGGYBACK_GOSSIP && par->MEMBERSHIP_MODE == GOSSIP_MEMBERSHIP) {
+        vector<size_t> fresh;
+        memberNode->memberList.collectNewest(PIGGYBACK_ENTRIES, fresh);
+        message.digest.clear();
+        for (size_t i = 0; i < fresh.size(); i++) {
+            Address entry = makeAddress(memberNode->memberList.getid(fresh[i]), memberNode->memberList.getport(fresh[i]));
+            message.digest.push_back(make_pair(entry, memberNode->memberList.getheartbeat(fresh[i])));
+        }
+
+        string peer(toAddr->addr, sizeof(toAddr->addr));
+        map<string, int>::iterator sent = memberNode->kvDigestSent.find(peer);
+        if (sent == memberNode->kvDigestSent.end() || sent->second != par->getcurrtime()) {
+            memberNode->kvDigestSent[peer] = par->getcurrtime();
+            memberNode->kvDigestPeers++;
         }
     }
-    return addr_vec;
+    if (memberNode->addr.getZone(par->NUM_ZONES) != toAddr->getZone(par->NUM_ZONES)) {
+        crossZoneMessages++;
+    }
+    Address destination = *toAddr;
+    emulNet->ENsend(&memberNode->addr, &destination, message.toString());
 }
 
 /**
@@ -778,48 +1237,1090 @@ int MP2Node::enqueueWrapper(void *env, char *buff, int size) {
  * DESCRIPTION: This runs the stabilization protocol in case of Node joins and leaves
  * 				It ensures that there always 3 copies of all keys in the DHT at all times
  *              Compare the Old and New replicas vectors, and see if there were any changes.
+ *              Only the keys whose replicas changed move, and only to the nodes that
+ *              became their replicas. The diff is queued as a rebalance that runs a slice
+ *              of keys at a time over the next ticks, so a large table neither overflows
+ *              the network nor holds up client requests in the tick of the change.
+ *              The rebalance keeps both snapshots alive until it is done.
+ */
+void MP2Node::stabilizationProtocol(shared_ptr<const RingSnapshot> oldSnapshot, shared_ptr<const RingSnapshot> newSnapshot) {
+    rebalanceJobs.push_back(RebalanceJob());
+    RebalanceJob &job = rebalanceJobs.back();
+    job.oldSnapshot = oldSnapshot;
+    job.newSnapshot = newSnapshot;
+    job.started = par->getcurrtime();
+}
+
+/**
+ * FUNCTION NAME: scanRebalance
+ *
+ * DESCRIPTION: Move the cursor of the oldest rebalance on and feed every moved key to the
+ *              stream of each node that gains it. Scanning stops once backlog, the chunks
+ *              waiting to be sent, reaches STABILIZE_BUDGET, so keys are read no faster
+ *              than they go out. A rebalance whose cursor passes the last key closes its
+ *              streams and the next one starts.
  */
-void MP2Node::stabilizationProtocol() {
+void MP2Node::scanRebalance(size_t backlog) {
+    size_t limit = par->STABILIZE_BUDGET;
+    map<string, string> &table = kvsHashTable->hashTable;
+
+    while (!rebalanceJobs.empty() && (limit == 0 || backlog < limit)) {
+        RebalanceJob &job = rebalanceJobs.front();
+        map<string, string>::iterator it = job.begun ? table.upper_bound(job.cursor) : table.begin();
+        vector<map<string, string>::iterator> slice;
+        vector<string> sliceKeys;
+        vector<uint64_t> positions;
+        for (; it != table.end() && slice.size() < REBALANCE_SCAN_SLICE; it++) {
+            slice.push_back(it);
+            sliceKeys.push_back(it->first);
+        }
+        stableHashBatch(sliceKeys, positions);
+
+        for (size_t k = 0; k < slice.size(); k++) {
+            const vector<Node> &oldReplicas = findNodesAt(positions[k], job.oldSnapshot->table);
+            if (!isRepairer(oldReplicas, job.newSnapshot->table)) {
+                continue;
+            }
+            vector<const Address *> gained;
+            gainedReplicas(positions[k], job.oldSnapshot->table, job.newSnapshot->table, gained);
+            bool moved = false;
+            for (size_t i = 0; i < gained.size(); i++) {
+                //a node that left since this ring change is the next rebalance's business
+                if (snapshot->table.members.count(string(gained[i]->addr, sizeof(gained[i]->addr))) == 0) {
+                    continue;
+                }
+                map<string, int>::iterator id = job.streamIds.find(gained[i]->getAddress());
+                if (id == job.streamIds.end()) {
+                    id = job.streamIds.insert(make_pair(gained[i]->getAddress(), nextStreamId++)).first;
+                    KeyStream &stream = streams[id->second];
+                    stream.destination = *gained[i];
+                    stream.open = true;
+                    stream.started = par->getcurrtime();
+                    stream.lastProgress = par->getcurrtime();
+                }
+                map<int, KeyStream>::iterator s = streams.find(id->second);
+                if (s == streams.end()) {
+                    continue;
+                }
+                KeyStream &stream = s->second;
+                if (startsChunk(stream.chunkSize, *slice[k])) {
+                    stream.chunkStarts.push_back(stream.entries.size());
+                    backlog++;
+                }
+                stream.entries.push_back(*slice[k]);
+                moved = true;
+            }
+            if (moved) {
+                job.moved++;
+            }
+        }
 
-    map<string, string>::iterator it;
-    vector<Node> failedNodes;
+        job.scanned += slice.size();
+        if (!slice.empty()) {
+            job.cursor = sliceKeys.back();
+            job.begun = true;
+        }
+        if (it == table.end()) {
+            for (map<string, int>::iterator id = job.streamIds.begin(); id != job.streamIds.end(); id++) {
+                map<int, KeyStream>::iterator s = streams.find(id->second);
+                if (s != streams.end()) {
+                    s->second.open = false;
+                }
+            }
+            log->LOG(&memberNode->addr, "#STATSLOG# rebalance scanned %ld moved %ld streams %lu ticks %d",
+                     job.scanned, job.moved, (unsigned long)job.streamIds.size(), par->getcurrtime() - job.started);
+            rebalanceJobs.pop_front();
+        }
+    }
+}
+
+/**
+ * FUNCTION NAME: collectMovedKeys
+ *
+ * DESCRIPTION: Diff two replica tables over the keys held here. Every key goes into the
+ *              batch of each node that is its replica in newTable but not in oldTable.
+ */
+void MP2Node::collectMovedKeys(const ReplicaTable &oldTable, const ReplicaTable &newTable,
+                               map<string, vector<pair<string, string> > > &batches) {
+    vector<string> heldKeys;
+    vector<uint64_t> positions;
+    for (map<string, string>::iterator it = kvsHashTable->hashTable.begin(); it != kvsHashTable->hashTable.end(); it++) {
+        heldKeys.push_back(it->first);
+    }
+    stableHashBatch(heldKeys, positions);
+
+    size_t k = 0;
+    for (map<string, string>::iterator it = kvsHashTable->hashTable.begin(); it != kvsHashTable->hashTable.end(); it++, k++) {
+        vector<const Address *> gained;
+        gainedReplicas(positions[k], oldTable, newTable, gained);
+        for (size_t i = 0; i < gained.size(); i++) {
+            batches[gained[i]->getAddress()].push_back(*it);
+        }
+    }
+}
 
-    for(it = kvsHashTable->hashTable.begin(); it != kvsHashTable->hashTable.end(); it++){
+/**
+ * FUNCTION NAME: gainedReplicas
+ *
+ * DESCRIPTION: The nodes that replicate a ring position in newTable but not in oldTable
+ */
+void MP2Node::gainedReplicas(uint64_t position, const ReplicaTable &oldTable, const ReplicaTable &newTable, vector<const Address *> &gained) {
+    const vector<Node> &oldReplicas = findNodesAt(position, oldTable);
+    const vector<Node> &newReplicas = findNodesAt(position, newTable);
+    for (size_t i = 0; i < newReplicas.size(); i++) {
+        bool isNew = true;
+        for (size_t j = 0; j < oldReplicas.size(); j++) {
+            if (*newReplicas[i].getAddress() == *oldReplicas[j].getAddress()) {
+                isNew = false;
+            }
+        }
+        if (isNew) {
+            gained.push_back(newReplicas[i].getAddress());
+        }
+    }
+}
 
-        string key = it->first;
-        string value = it->second;
-        long tID = addTransaction(key, value, CREATE);
-        string blank = "";
+/**
+ * FUNCTION NAME: isRepairer
+ *
+ * DESCRIPTION: Whether this node repairs a key after a ring change. The repairer is the
+ *              first of the key's old replicas, in PRIMARY, SECONDARY, TERTIARY order,
+ *              that is still on the new ring, so every survivor agrees on it and the
+ *              ones after it stand by in case it is gone too. When no old replica is
+ *              left, every node holding the key repairs it.
+ */
+bool MP2Node::isRepairer(const vector<Node> &oldReplicas, const ReplicaTable &newTable) {
+    for (size_t i = 0; i < oldReplicas.size(); i++) {
+        const Address *replica = oldReplicas[i].getAddress();
+        if (newTable.members.count(string(replica->addr, sizeof(replica->addr)))) {
+            return *replica == memberNode->addr;
+        }
+    }
+    return true;
+}
+
+/**
+ * FUNCTION NAME: sendKeyBatches
+ *
+ * DESCRIPTION: Send every batch of keys to its node, packed into as few HANDOFF messages
+ *              as MAX_MSG_SIZE allows. Returns the number of keys sent and adds the
+ *              number of messages to messages.
+ */
+int MP2Node::sendKeyBatches(map<string, vector<pair<string, string> > > &batches, int &messages) {
+    int keys = 0;
+    for (map<string, vector<pair<string, string> > >::iterator it = batches.begin(); it != batches.end(); it++) {
+        Address destination(it->first);
+        vector<size_t> chunkStarts;
+        chunkEntries(it->second, chunkStarts);
+        for (size_t i = 0; i + 1 < chunkStarts.size(); i++) {
+            vector<pair<string, string> > chunk(it->second.begin() + chunkStarts[i], it->second.begin() + chunkStarts[i + 1]);
+            Message msg(0, memberNode->addr, chunk);
+            sendMessage(&destination, msg);
+            messages++;
+        }
+        keys += it->second.size();
+    }
+    return keys;
+}
+
+/**
+ * FUNCTION NAME: chunkEntries
+ *
+ * DESCRIPTION: Split key value pairs into chunks that fit in one message each. chunkStarts
+ *              gets the first entry of every chunk, followed by the number of entries.
+ */
+void MP2Node::chunkEntries(vector<pair<string, string> > &entries, vector<size_t> &chunkStarts) {
+    size_t chunkSize = 0;
+    chunkStarts.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (startsChunk(chunkSize, entries[i])) {
+            chunkStarts.push_back(i);
+        }
+    }
+    chunkStarts.push_back(entries.size());
+}
+
+/**
+ * FUNCTION NAME: startsChunk
+ *
+ * DESCRIPTION: Whether an entry added after a chunk of chunkSize bytes starts a new chunk,
+ *              where an empty chunk has size 0. chunkSize becomes the size of the chunk
+ *              the entry went into.
+ */
+bool MP2Node::startsChunk(size_t &chunkSize, const pair<string, string> &entry) {
+    bool starts = chunkSize == 0 || chunkSize + entrySize(entry) > maxChunkSize();
+    if (starts) {
+        chunkSize = 0;
+    }
+    chunkSize += entrySize(entry);
+    return starts;
+}
 
-        //get replicas for the current key
-        vector<Node> replicaNodes = findNodes(it->first);
+/**
+ * FUNCTION NAME: maxChunkSize
+ *
+ * DESCRIPTION: The most bytes of entries one message can carry
+ */
+size_t MP2Node::maxChunkSize() {
+    //leave room for the message header and the EmulNet envelope
+    return par->MAX_MSG_SIZE - sizeof(en_msg) - KV_HEADER_ROOM;
+}
 
-        Message msg1 (tID, memberNode->addr, CREATE, key, value, PRIMARY);
-        emulNet->ENsend(&memberNode->addr, replicaNodes[0].getAddress(), msg1.toString());
-        Node n = replicaNodes[0];
-        Address a = *n.getAddress();
-        string s = "sending create message to" + a.getAddress();
-        //trace("stabilizationProtocoal",tID,memberNode->addr,key,blank, s);
+/**
+ * FUNCTION NAME: entrySize
+ *
+ * DESCRIPTION: The bytes an entry takes in a message, with its delimiters
+ */
+size_t MP2Node::entrySize(const pair<string, string> &entry) {
+    return entry.first.size() + entry.second.size() + 4;
+}
 
+/**
+ * FUNCTION NAME: readyChunks
+ *
+ * DESCRIPTION: The number of chunks of a stream that can be sent. The last chunk of an
+ *              open stream may still grow, so it waits until the stream is closed.
+ */
+size_t MP2Node::readyChunks(KeyStream &stream) {
+    if (stream.open && !stream.chunkStarts.empty()) {
+        return stream.chunkStarts.size() - 1;
+    }
+    return stream.chunkStarts.size();
+}
 
-        Message msg2 (tID, memberNode->addr, CREATE, key, value, SECONDARY);
-        emulNet->ENsend(&memberNode->addr, replicaNodes[1].getAddress(), msg2.toString());
-        n = replicaNodes[1];
-        a = *n.getAddress();
-        s = "sending create message to" + a.getAddress();
-        //trace("stabilizationProtocoal",tID,memberNode->addr,key,blank, s);
+/**
+ * FUNCTION NAME: sendNextChunk
+ *
+ * DESCRIPTION: Send the next chunk of a stream if it is ready and fits in the window.
+ *              Returns whether a chunk was sent.
+ */
+bool MP2Node::sendNextChunk(int streamId, KeyStream &stream) {
+    if (stream.sent >= readyChunks(stream) || stream.sent >= stream.acked + STREAM_WINDOW) {
+        return false;
+    }
+    //an idle stream starts its ack timeout over
+    if (stream.sent == stream.acked) {
+        stream.lastProgress = par->getcurrtime();
+    }
+    size_t end = stream.sent + 1 < stream.chunkStarts.size() ? stream.chunkStarts[stream.sent + 1] : stream.entries.size();
+    vector<pair<string, string> > chunk(stream.entries.begin() + stream.chunkStarts[stream.sent],
+                                        stream.entries.begin() + end);
+    Message msg(streamId, memberNode->addr, (int)stream.sent, chunk);
+    sendMessage(&stream.destination, msg);
+    stream.sent++;
+    return true;
+}
 
+/**
+ * FUNCTION NAME: advanceStreams
+ *
+ * DESCRIPTION: Called every tick. A stream whose node has left the ring is dropped, and
+ *              one that has gone STREAM_ACK_TIMEOUT ticks without an ack, plus a round
+ *              trip across zones, goes back to its last acked chunk, unless it has already
+ *              done so STREAM_MAX_RETRIES times. The rebalance scan then tops up the chunks
+ *              waiting to be sent, and up to STABILIZE_BUDGET chunks go out, one per stream
+ *              in turn so that every stream moves.
+ */
+void MP2Node::advanceStreams() {
+    size_t backlog = 0;
+    map<int, KeyStream>::iterator it = streams.begin();
+    while (it != streams.end()) {
+        KeyStream &stream = it->second;
+        bool onRing = snapshot->table.members.count(string(stream.destination.addr, sizeof(stream.destination.addr))) > 0;
+        if (!onRing || stream.retries >= STREAM_MAX_RETRIES) {
+            log->LOG(&memberNode->addr, "#STATSLOG# stream to %s dropped at chunk %lu of %lu",
+                     stream.destination.getAddress().c_str(), (unsigned long)stream.acked,
+                     (unsigned long)stream.chunkStarts.size());
+            if (onRing) {
+                closeStream(it->first, stream);
+            }
+            it = streams.erase(it);
+            continue;
+        }
+        if (stream.sent > stream.acked && par->getcurrtime() - stream.lastProgress >= STREAM_ACK_TIMEOUT + 2 * par->ZONE_LATENCY) {
+            stream.sent = stream.acked;
+            stream.lastProgress = par->getcurrtime();
+            stream.retries++;
+        }
+        backlog += stream.chunkStarts.size() - stream.sent;
+        it++;
+    }
 
-        Message msg3 (tID, memberNode->addr, CREATE, key, value, TERTIARY);
-        emulNet->ENsend(&memberNode->addr, replicaNodes[2].getAddress(), msg3.toString());
-        n = replicaNodes[2];
-        a = *n.getAddress();
-        s = "sending create message to" + a.getAddress();
-        //trace("stabilizationProtocoal",tID,memberNode->addr,key,blank, s);
+    //forget the incoming streams of nodes that have left the ring
+    map<string, StreamCursor>::iterator cursor = streamCursors.begin();
+    while (cursor != streamCursors.end()) {
+        Address &source = cursor->second.source;
+        if (snapshot->table.members.count(string(source.addr, sizeof(source.addr))) == 0) {
+            cursor = streamCursors.erase(cursor);
+        } else {
+            cursor++;
+        }
+    }
 
-       }
+    scanRebalance(backlog);
+
+    int limit = par->STABILIZE_BUDGET;
+    int sent = 0;
+    bool progress = true;
+    while (progress && (limit == 0 || sent < limit)) {
+        progress = false;
+        for (it = streams.begin(); it != streams.end() && (limit == 0 || sent < limit); it++) {
+            if (sendNextChunk(it->first, it->second)) {
+                sent++;
+                progress = true;
+            }
+        }
+    }
+    chunksStreamed += sent;
+    peakChunksPerTick = max(peakChunksPerTick, sent);
 }
 
+/**
+ * FUNCTION NAME: streamMessageHandler
+ *
+ * DESCRIPTION: Store a chunk of a key stream and ack every chunk received without a gap
+ *              so far. Chunks of one window can arrive in any order, so those past the
+ *              next one expected are stored too and counted once the gap fills. Storing
+ *              a key twice does nothing, so resent chunks are harmless.
+ */
+void MP2Node::streamMessageHandler(Message incomingMessage) {
+    string streamKey = incomingMessage.fromAddr.getAddress() + "#" + to_string(incomingMessage.transID);
+    StreamCursor &cursor = streamCursors[streamKey];
+    cursor.source = incomingMessage.fromAddr;
+    if (incomingMessage.cursor >= cursor.expected && cursor.ahead.count(incomingMessage.cursor) == 0) {
+        for (size_t i = 0; i < incomingMessage.entries.size(); i++) {
+            if (!holdsRecord(incomingMessage.entries[i].first)) {
+                storeKey(incomingMessage.entries[i].first, incomingMessage.entries[i].second, 0);
+            }
+        }
+        cursor.ahead.insert(incomingMessage.cursor);
+        while (cursor.ahead.erase(cursor.expected)) {
+            cursor.expected++;
+        }
+    }
+    Message ack(incomingMessage.transID, memberNode->addr, cursor.expected);
+    sendMessage(&incomingMessage.fromAddr, ack);
+}
+
+/**
+ * FUNCTION NAME: streamAckMessageHandler
+ *
+ * DESCRIPTION: Move a stream's cursor up to the chunk its node expects next. The chunks
+ *              that frees up go out with the rest of the tick's budget in advanceStreams.
+ *              A closed stream is done once every chunk is acked, and its node is told.
+ *              An ack of STREAM_CLOSED is that word for a stream coming here.
+ */
+void MP2Node::streamAckMessageHandler(Message incomingMessage) {
+    if (incomingMessage.cursor == STREAM_CLOSED) {
+        streamCursors.erase(incomingMessage.fromAddr.getAddress() + "#" + to_string(incomingMessage.transID));
+        return;
+    }
+    map<int, KeyStream>::iterator it = streams.find(incomingMessage.transID);
+    if (it == streams.end()) {
+        return;
+    }
+    KeyStream &stream = it->second;
+    size_t acked = incomingMessage.cursor;
+    if (acked <= stream.acked) {
+        return;
+    }
+    stream.acked = acked;
+    stream.sent = max(stream.sent, acked);
+    stream.lastProgress = par->getcurrtime();
+    stream.retries = 0;
+
+    size_t total = stream.chunkStarts.size();
+    if (!stream.open && stream.acked >= total) {
+        log->LOG(&memberNode->addr, "#STATSLOG# stream to %s done keys %lu chunks %lu ticks %d",
+                 stream.destination.getAddress().c_str(), (unsigned long)stream.entries.size(),
+                 (unsigned long)total, par->getcurrtime() - stream.started);
+        closeStream(it->first, stream);
+        streams.erase(it);
+    }
+}
+
+/**
+ * FUNCTION NAME: closeStream
+ *
+ * DESCRIPTION: Tell the node of a stream that is done or dropped to forget its cursor
+ */
+void MP2Node::closeStream(int streamId, KeyStream &stream) {
+    Message close(streamId, memberNode->addr, STREAM_CLOSED);
+    sendMessage(&stream.destination, close);
+}
+
+/**
+ * FUNCTION NAME: storeHints
+ *
+ * DESCRIPTION: Called when a write a quorum of replicas took times out. Every replica the
+ * 				write was sent to that did not ack it gets a hint holding it, as written in
+ * 				the tick it reached the others, unless a later write of the key is already
+ * 				hinted. The ring may have moved on since, and then the rebalance, not the
+ * 				hint, brings the key to its new replicas.
+ */
+void MP2Node::storeHints(Transaction &transaction) {
+    string record = to_string(transaction.time + 1) + (transaction.type == DELETE ? ":D" : ":L:" + transaction.value);
+    for (size_t i = 0; i < transaction.replicas.size(); i++) {
+        string replica = transaction.replicas[i].getAddress();
+        if (transaction.acked.count(replica)) {
+            continue;
+        }
+        string &hint = hintQueues[replica].records[transaction.key];
+        if (hint.empty() || stoi(hint) <= transaction.time + 1) {
+            hint = record;
+            hintsStored++;
+        }
+    }
+}
+
+/**
+ * FUNCTION NAME: replayHints
+ *
+ * DESCRIPTION: Called every tick. The hints of every replica whose wait is over are sent
+ * 				to it in HINT messages, or only the first of them while it has not answered
+ * 				the last replay. The hints of a replica that left the ring are dropped, as
+ * 				the stabilization protocol gives its keys new replicas.
+ */
+void MP2Node::replayHints() {
+    map<string, HintQueue>::iterator it = hintQueues.begin();
+    while (it != hintQueues.end()) {
+        Address destination(it->first);
+        HintQueue &queue = it->second;
+        if (queue.records.empty() || snapshot->table.members.count(string(destination.addr, sizeof(destination.addr))) == 0) {
+            it = hintQueues.erase(it);
+            continue;
+        }
+        if (par->getcurrtime() < queue.nextReplay) {
+            it++;
+            continue;
+        }
+
+        //the chunks of an earlier replay are not waited on any longer
+        for (map<int, HintChunk>::iterator chunk = hintChunks.begin(); chunk != hintChunks.end(); ) {
+            if (chunk->second.destination == it->first) {
+                chunk = hintChunks.erase(chunk);
+            } else {
+                chunk++;
+            }
+        }
+
+        vector<pair<string, string> > records(queue.records.begin(), queue.records.end());
+        vector<size_t> chunkStarts;
+        chunkEntries(records, chunkStarts);
+        size_t chunks = queue.answered ? chunkStarts.size() - 1 : 1;
+        for (size_t i = 0; i < chunks; i++) {
+            int hintId = nextHintId++;
+            HintChunk &chunk = hintChunks[hintId];
+            chunk.destination = it->first;
+            chunk.records.assign(records.begin() + chunkStarts[i], records.begin() + chunkStarts[i + 1]);
+            Message msg(hintId, memberNode->addr, HINT, 0, chunk.records);
+            sendMessage(&destination, msg);
+        }
+
+        queue.nextReplay = par->getcurrtime() + queue.backoff;
+        queue.backoff = min(queue.backoff * 2, HINT_BACKOFF_MAX);
+        queue.answered = false;
+        it++;
+    }
+}
+
+/**
+ * FUNCTION NAME: hintMessageHandler
+ *
+ * DESCRIPTION: Apply the hinted writes of the keys this node replicates that are newer
+ * 				than those held here, and ack them all
+ */
+void MP2Node::hintMessageHandler(Message incomingMessage) {
+    for (size_t i = 0; i < incomingMessage.entries.size(); i++) {
+        string &key = incomingMessage.entries[i].first;
+        const vector<Node> &replicas = findNodes(key);
+        for (size_t j = 0; j < replicas.size(); j++) {
+            if (*replicas[j].getAddress() == memberNode->addr) {
+                applyRecord(key, incomingMessage.entries[i].second);
+            }
+        }
+    }
+    vector<pair<string, string> > none;
+    Message ack(incomingMessage.transID, memberNode->addr, HINT_ACK, 0, none);
+    sendMessage(&incomingMessage.fromAddr, ack);
+}
+
+/**
+ * FUNCTION NAME: hintAckMessageHandler
+ *
+ * DESCRIPTION: Drop the hints a replica acked, unless a later write has replaced them
+ * 				since, and send it the rest right away
+ */
+void MP2Node::hintAckMessageHandler(Message incomingMessage) {
+    map<int, HintChunk>::iterator chunk = hintChunks.find(incomingMessage.transID);
+    if (chunk == hintChunks.end()) {
+        return;
+    }
+    HintQueue &queue = hintQueues[chunk->second.destination];
+    for (size_t i = 0; i < chunk->second.records.size(); i++) {
+        map<string, string>::iterator hint = queue.records.find(chunk->second.records[i].first);
+        if (hint != queue.records.end() && hint->second == chunk->second.records[i].second) {
+            queue.records.erase(hint);
+            hintsDelivered++;
+        }
+    }
+    if (!queue.answered) {
+        queue.answered = true;
+        queue.nextReplay = par->getcurrtime() + 1;
+    }
+    queue.backoff = HINT_BACKOFF_MIN;
+    hintChunks.erase(chunk);
+}
+
+/**
+ * FUNCTION NAME: handOffKeys
+ *
+ * DESCRIPTION: Called before this node leaves the group on purpose. Every key held here
+ *              goes to the node that becomes its replica once this node is off the ring,
+ *              so the rest of the group need not run the stabilization protocol.
+ */
+void MP2Node::handOffKeys() {
+    vector<Node> remaining;
+    const vector<Node> &ring = snapshot->ring;
+    for (size_t i = 0; i < ring.size(); i++) {
+        if (!(*ring[i].getAddress() == memberNode->addr)) {
+            remaining.push_back(ring[i]);
+        }
+    }
+
+    ReplicaTable remainingTable;
+    buildReplicaTable(remaining, remainingTable);
+
+    map<string, vector<pair<string, string> > > batches;
+    collectMovedKeys(snapshot->table, remainingTable, batches);
+
+    int messages = 0;
+    int keys = sendKeyBatches(batches, messages);
+    log->LOG(&memberNode->addr, "#STATSLOG# handoff keys %d messages %d", keys, messages);
+}
+
+/**
+ * FUNCTION NAME: logLoadStats
+ *
+ * DESCRIPTION: Write the keys held here, the requests served as a replica and the share
+ * 				of the ring this node is the primary for to the stats log. A token owns the
+ * 				arc from the token before it.
+ */
+void MP2Node::logLoadStats() {
+    const vector<uint64_t> &tokens = snapshot->table.tokens;
+    double share = 0;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        if (*snapshot->table.replicaSets[i][0].getAddress() == memberNode->addr) {
+            uint64_t arc = tokens[i] - tokens[(i + tokens.size() - 1) % tokens.size()];
+            share += (double)arc / 18446744073709551616.0;
+        }
+    }
+    log->LOG(&memberNode->addr, "#STATSLOG# kv load keys %lu requests %ld ring share %.1f%%",
+             (unsigned long)kvsHashTable->currentSize(), requestsServed, share * 100);
+    log->LOG(&memberNode->addr, "#STATSLOG# rebalance chunks sent %ld peak per tick %d pending rebalances %lu open incoming streams %lu",
+             chunksStreamed, peakChunksPerTick, (unsigned long)rebalanceJobs.size(), (unsigned long)streamCursors.size());
+    log->LOG(&memberNode->addr, "#STATSLOG# anti-entropy rounds %ld messages %ld keys repaired %ld tombstones %lu",
+             antiEntropyRounds, antiEntropyMessages, keysRepaired, (unsigned long)tombstones.size());
+    size_t pendingHints = 0;
+    for (map<string, HintQueue>::iterator it = hintQueues.begin(); it != hintQueues.end(); it++) {
+        pendingHints += it->second.records.size();
+    }
+    log->LOG(&memberNode->addr, "#STATSLOG# hints stored %ld delivered %ld pending %lu",
+             hintsStored, hintsDelivered, (unsigned long)pendingHints);
+    log->LOG(&memberNode->addr, "#STATSLOG# ring changes %ld stabilizations %ld avoided %ld",
+             ringChanges, stabilizationRuns, ringChanges - stabilizationRuns);
+    log->LOG(&memberNode->addr, "#STATSLOG# ring snapshots built %ld shared %ld views live %lu",
+             snapshotsBuilt, snapshotsShared, (unsigned long)ringSnapshots.size());
+    log->LOG(&memberNode->addr, "#STATSLOG# quorum ticks read %.2f write %.2f reads hedged %ld cross-zone messages %ld",
+             readQuorums > 0 ? (double)readQuorumTicks / readQuorums : 0.0,
+             writeQuorums > 0 ? (double)writeQuorumTicks / writeQuorums : 0.0, readsHedged, crossZoneMessages);
+}
+
+/**
+ * FUNCTION NAME: handoffMessageHandler
+ *
+ * DESCRIPTION: Store the keys handed off by a leaving node
+ */
+void MP2Node::handoffMessageHandler(Message incomingMessage) {
+    for (size_t i = 0; i < incomingMessage.entries.size(); i++) {
+        if (!holdsRecord(incomingMessage.entries[i].first)) {
+            storeKey(incomingMessage.entries[i].first, incomingMessage.entries[i].second, 0);
+        }
+    }
+}
+
+/**
+ * FUNCTION NAME: storeKey
+ *
+ * DESCRIPTION: Store a key written at tick written, replacing its value or tombstone
+ */
+void MP2Node::storeKey(const string &key, const string &value, int written) {
+    uint64_t before = recordDigest(key);
+    kvsHashTable->hashTable[key] = value;
+    writeTimes[key] = written;
+    tombstones.erase(key);
+    merkleChange(key, before);
+}
+
+/**
+ * FUNCTION NAME: removeKey
+ *
+ * DESCRIPTION: Delete a key at tick written, leaving a tombstone in its place even if it
+ * 				was not here, so a stale copy elsewhere is not repaired back. Returns whether
+ * 				the key was here.
+ */
+bool MP2Node::removeKey(const string &key, int written) {
+    uint64_t before = recordDigest(key);
+    bool removed = kvsHashTable->deleteKey(key);
+    writeTimes.erase(key);
+    tombstones[key] = written;
+    merkleChange(key, before);
+    return removed;
+}
+
+/**
+ * FUNCTION NAME: forgetKey
+ *
+ * DESCRIPTION: Drop a key and its tombstone as if no write of it had ever arrived here,
+ * 				leaving no trace for the other replicas to see. Used by the scenario tests
+ * 				to stand in for a lost write.
+ */
+void MP2Node::forgetKey(const string &key) {
+    uint64_t before = recordDigest(key);
+    kvsHashTable->deleteKey(key);
+    writeTimes.erase(key);
+    tombstones.erase(key);
+    merkleChange(key, before);
+}
+
+/**
+ * FUNCTION NAME: holdsRecord
+ *
+ * DESCRIPTION: Whether this node holds a key or its tombstone
+ */
+bool MP2Node::holdsRecord(const string &key) {
+    return kvsHashTable->count(key) > 0 || tombstones.count(key) > 0;
+}
+
+/**
+ * FUNCTION NAME: digestOf
+ *
+ * DESCRIPTION: The digest of a key and its value, or of its tombstone
+ */
+static uint64_t digestOf(const string &key, bool deleted, const string &value) {
+    return stableHash(key + string(1, '\0') + (deleted ? "D" : "L" + value));
+}
+
+/**
+ * FUNCTION NAME: newerRecord
+ *
+ * DESCRIPTION: Whether a record beats another. The later write wins, and of two writes
+ * 				in the same tick the larger digest, so both replicas pick the same one.
+ */
+static bool newerRecord(int written, uint64_t digest, int otherWritten, uint64_t otherDigest) {
+    return written > otherWritten || (written == otherWritten && digest > otherDigest);
+}
+
+/**
+ * FUNCTION NAME: recordDigest
+ *
+ * DESCRIPTION: The digest of what this node holds for a key, or 0 if it holds nothing
+ */
+uint64_t MP2Node::recordDigest(const string &key) {
+    map<string, string>::iterator live = kvsHashTable->hashTable.find(key);
+    if (live != kvsHashTable->hashTable.end()) {
+        return digestOf(key, false, live->second);
+    }
+    if (tombstones.count(key)) {
+        return digestOf(key, true, "");
+    }
+    return 0;
+}
+
+/**
+ * FUNCTION NAME: recordTime
+ *
+ * DESCRIPTION: The tick this node last wrote or deleted a key, or -1 if it holds nothing
+ */
+int MP2Node::recordTime(const string &key) {
+    map<string, int>::iterator it = writeTimes.find(key);
+    if (it != writeTimes.end()) {
+        return it->second;
+    }
+    it = tombstones.find(key);
+    return it != tombstones.end() ? it->second : -1;
+}
+
+/**
+ * FUNCTION NAME: encodeRecord
+ *
+ * DESCRIPTION: What this node holds for a key as carried by a REPAIR, written:L:value
+ * 				for a value and written:D for a tombstone
+ */
+string MP2Node::encodeRecord(const string &key) {
+    map<string, string>::iterator live = kvsHashTable->hashTable.find(key);
+    if (live != kvsHashTable->hashTable.end()) {
+        return to_string(recordTime(key)) + ":L:" + live->second;
+    }
+    return to_string(recordTime(key)) + ":D";
+}
+
+/**
+ * FUNCTION NAME: leafOf
+ *
+ * DESCRIPTION: The Merkle leaf a key falls in, as range/index. The ring must have tokens.
+ */
+string MP2Node::leafOf(const string &key) {
+    uint64_t position = hashFunction(key);
+    uint64_t range = snapshot->table.tokens[tokenIndexAt(position, snapshot->table)];
+    return to_string(range) + "/" + to_string(position % MERKLE_LEAF_COUNT);
+}
+
+/**
+ * FUNCTION NAME: merkleChange
+ *
+ * DESCRIPTION: Move the Merkle leaf of a key from the digest it had before a write to
+ * 				the one it has now
+ */
+void MP2Node::merkleChange(const string &key, uint64_t before) {
+    uint64_t after = recordDigest(key);
+    if (after == before || snapshot->table.tokens.empty()) {
+        return;
+    }
+    uint64_t position = hashFunction(key);
+    vector<uint64_t> &leaves = merkleLeaves[snapshot->table.tokens[tokenIndexAt(position, snapshot->table)]];
+    leaves.resize(MERKLE_LEAF_COUNT);
+    leaves[position % MERKLE_LEAF_COUNT] += after - before;
+}
+
+/**
+ * FUNCTION NAME: rebuildMerkle
+ *
+ * DESCRIPTION: Rebuild every Merkle tree from the keys and tombstones held here, for the
+ * 				token ranges of a new ring
+ */
+void MP2Node::rebuildMerkle() {
+    merkleLeaves.clear();
+    for (map<string, string>::iterator it = kvsHashTable->hashTable.begin(); it != kvsHashTable->hashTable.end(); it++) {
+        merkleChange(it->first, 0);
+    }
+    for (map<string, int>::iterator it = tombstones.begin(); it != tombstones.end(); it++) {
+        merkleChange(it->first, 0);
+    }
+}
+
+/**
+ * FUNCTION NAME: expireTombstones
+ *
+ * DESCRIPTION: Forget the tombstones older than TOMBSTONE_TTL ticks
+ */
+void MP2Node::expireTombstones() {
+    map<string, int>::iterator it = tombstones.begin();
+    while (it != tombstones.end()) {
+        if (it->second + TOMBSTONE_TTL > par->getcurrtime()) {
+            it++;
+            continue;
+        }
+        string key = it->first;
+        uint64_t before = recordDigest(key);
+        it = tombstones.erase(it);
+        merkleChange(key, before);
+    }
+}
+
+/**
+ * FUNCTION NAME: merkleHash
+ *
+ * DESCRIPTION: The hash of a node of a range's Merkle tree. A leaf is the sum of its key
+ * 				digests, and a branch or the root the hash of its children.
+ */
+uint64_t MP2Node::merkleHash(uint64_t range, int step, int index) {
+    static const vector<uint64_t> noLeaves(MERKLE_LEAF_COUNT);
+    map<uint64_t, vector<uint64_t> >::iterator it = merkleLeaves.find(range);
+    const vector<uint64_t> &leaves = it != merkleLeaves.end() ? it->second : noLeaves;
+    if (step == MERKLE_LEAF) {
+        return leaves[index];
+    }
+    if (step == MERKLE_BRANCH) {
+        return stableHash((const char *)&leaves[index * MERKLE_FANOUT], MERKLE_FANOUT * sizeof(uint64_t));
+    }
+    uint64_t branches[MERKLE_FANOUT];
+    for (int i = 0; i < MERKLE_FANOUT; i++) {
+        branches[i] = merkleHash(range, MERKLE_BRANCH, i);
+    }
+    return stableHash((const char *)branches, sizeof(branches));
+}
+
+/**
+ * FUNCTION NAME: collectLeafKeys
+ *
+ * DESCRIPTION: The keys and tombstones held here that fall in the given Merkle leaves,
+ * 				by leaf. Without a ring no key falls in a leaf.
+ */
+void MP2Node::collectLeafKeys(set<string> &leaves, map<string, vector<string> > &keys) {
+    if (snapshot->table.tokens.empty()) {
+        return;
+    }
+    for (map<string, string>::iterator it = kvsHashTable->hashTable.begin(); it != kvsHashTable->hashTable.end(); it++) {
+        string leaf = leafOf(it->first);
+        if (leaves.count(leaf)) {
+            keys[leaf].push_back(it->first);
+        }
+    }
+    for (map<string, int>::iterator it = tombstones.begin(); it != tombstones.end(); it++) {
+        string leaf = leafOf(it->first);
+        if (leaves.count(leaf)) {
+            keys[leaf].push_back(it->first);
+        }
+    }
+}
+
+/**
+ * FUNCTION NAME: runAntiEntropy
+ *
+ * DESCRIPTION: Called every tick. Every ANTI_ENTROPY_PERIOD ticks, staggered by node id,
+ * 				send the next co-replica in turn the Merkle roots of all the token ranges
+ * 				the two replicate together, and expire old tombstones.
+ */
+void MP2Node::runAntiEntropy() {
+    if (snapshot->table.tokens.empty() || (par->getcurrtime() + getMyId()) % ANTI_ENTROPY_PERIOD != 0) {
+        return;
+    }
+    expireTombstones();
+
+    map<string, vector<pair<string, string> > > roots;
+    for (size_t i = 0; i < snapshot->table.tokens.size(); i++) {
+        const vector<Node> &replicas = snapshot->table.replicaSets[i];
+        bool replicated = false;
+        for (size_t j = 0; j < replicas.size(); j++) {
+            replicated = replicated || *replicas[j].getAddress() == memberNode->addr;
+        }
+        if (!replicated) {
+            continue;
+        }
+        string node = to_string(snapshot->table.tokens[i]) + "/0";
+        string root = to_string(merkleHash(snapshot->table.tokens[i], MERKLE_ROOT, 0));
+        for (size_t j = 0; j < replicas.size(); j++) {
+            if (!(*replicas[j].getAddress() == memberNode->addr)) {
+                roots[replicas[j].getAddress()->getAddress()].push_back(make_pair(node, root));
+            }
+        }
+    }
+    if (roots.empty()) {
+        return;
+    }
+
+    map<string, vector<pair<string, string> > >::iterator peer = roots.begin();
+    advance(peer, antiEntropyRounds % roots.size());
+    Address destination(peer->first);
+    sendEntries(&destination, MERKLE, MERKLE_ROOT, peer->second);
+    antiEntropyRounds++;
+}
+
+/**
+ * FUNCTION NAME: sharesRange
+ *
+ * DESCRIPTION: Whether this node and peer both replicate the token range ending at range
+ */
+bool MP2Node::sharesRange(uint64_t range, Address &peer) {
+    if (!binary_search(snapshot->table.tokens.begin(), snapshot->table.tokens.end(), range)) {
+        return false;
+    }
+    const vector<Node> &replicas = findNodesAt(range, snapshot->table);
+    bool self = false;
+    bool other = false;
+    for (size_t i = 0; i < replicas.size(); i++) {
+        self = self || *replicas[i].getAddress() == memberNode->addr;
+        other = other || *replicas[i].getAddress() == peer;
+    }
+    return self && other;
+}
+
+/**
+ * FUNCTION NAME: merkleMessageHandler
+ *
+ * DESCRIPTION: Answer a step of a Merkle tree comparison. Of the tree nodes sent, those
+ * 				that differ here are answered with their children, and differing leaves
+ * 				with the records of their keys, each after an entry with an empty key
+ * 				naming the leaf. A MERKLE_WANT is answered with the records asked for.
+ * 				Nodes of ranges the two do not replicate together are left out, and a
+ * 				node without a ring replicates no range with anyone.
+ */
+void MP2Node::merkleMessageHandler(Message incomingMessage) {
+    int step = incomingMessage.cursor;
+    Address &fromAddr = incomingMessage.fromAddr;
+    vector<pair<string, string> > reply;
+    if (snapshot->table.tokens.empty()) {
+        return;
+    }
+
+    if (step == MERKLE_KEYS) {
+        compareKeys(incomingMessage);
+        return;
+    }
+    if (step == MERKLE_WANT) {
+        for (size_t i = 0; i < incomingMessage.entries.size(); i++) {
+            string &key = incomingMessage.entries[i].first;
+            if (holdsRecord(key) && sharesRange(snapshot->table.tokens[tokenIndexAt(hashFunction(key), snapshot->table)], fromAddr)) {
+                reply.push_back(make_pair(key, encodeRecord(key)));
+            }
+        }
+        sendEntries(&fromAddr, REPAIR, 0, reply);
+        return;
+    }
+
+    set<string> leaves;
+    for (size_t i = 0; i < incomingMessage.entries.size(); i++) {
+        string &node = incomingMessage.entries[i].first;
+        size_t slash = node.find('/');
+        uint64_t range = stoull(node.substr(0, slash));
+        int index = stoi(node.substr(slash + 1));
+        if (!sharesRange(range, fromAddr) || stoull(incomingMessage.entries[i].second) == merkleHash(range, step, index)) {
+            continue;
+        }
+        if (step == MERKLE_LEAF) {
+            leaves.insert(node);
+            continue;
+        }
+        for (int c = 0; c < MERKLE_FANOUT; c++) {
+            int child = step == MERKLE_ROOT ? c : index * MERKLE_FANOUT + c;
+            reply.push_back(make_pair(to_string(range) + "/" + to_string(child), to_string(merkleHash(range, step + 1, child))));
+        }
+    }
+
+    if (step == MERKLE_LEAF) {
+        map<string, vector<string> > keys;
+        collectLeafKeys(leaves, keys);
+        for (set<string>::iterator leaf = leaves.begin(); leaf != leaves.end(); leaf++) {
+            reply.push_back(make_pair("", *leaf));
+            vector<string> &leafKeys = keys[*leaf];
+            for (size_t i = 0; i < leafKeys.size(); i++) {
+                reply.push_back(make_pair(leafKeys[i], to_string(recordTime(leafKeys[i])) + ":" + to_string(recordDigest(leafKeys[i]))));
+            }
+        }
+    }
+    sendEntries(&fromAddr, MERKLE, step + 1, reply);
+}
+
+/**
+ * FUNCTION NAME: compareKeys
+ *
+ * DESCRIPTION: Compare the records of a peer's differing leaves with those held here. A
+ * 				record the peer lacks or holds an older version of is sent to it as a
+ * 				REPAIR, and one it holds a newer version of is asked for.
+ */
+void MP2Node::compareKeys(Message &incomingMessage) {
+    set<string> leaves;
+    map<string, pair<int, uint64_t> > theirs;
+    for (size_t i = 0; i < incomingMessage.entries.size(); i++) {
+        pair<string, string> &entry = incomingMessage.entries[i];
+        if (entry.first.empty()) {
+            leaves.insert(entry.second);
+            continue;
+        }
+        size_t colon = entry.second.find(':');
+        theirs[entry.first] = make_pair(stoi(entry.second.substr(0, colon)), stoull(entry.second.substr(colon + 1)));
+    }
+
+    map<string, vector<string> > ours;
+    collectLeafKeys(leaves, ours);
+    vector<pair<string, string> > pushes;
+    vector<pair<string, string> > wants;
+    for (map<string, vector<string> >::iterator leaf = ours.begin(); leaf != ours.end(); leaf++) {
+        for (size_t i = 0; i < leaf->second.size(); i++) {
+            string &key = leaf->second[i];
+            map<string, pair<int, uint64_t> >::iterator other = theirs.find(key);
+            if (other == theirs.end() || newerRecord(recordTime(key), recordDigest(key), other->second.first, other->second.second)) {
+                pushes.push_back(make_pair(key, encodeRecord(key)));
+            }
+        }
+    }
+    for (map<string, pair<int, uint64_t> >::iterator other = theirs.begin(); other != theirs.end(); other++) {
+        if (newerRecord(other->second.first, other->second.second, recordTime(other->first), recordDigest(other->first))) {
+            wants.push_back(make_pair(other->first, ""));
+        }
+    }
+    sendEntries(&incomingMessage.fromAddr, REPAIR, 0, pushes);
+    sendEntries(&incomingMessage.fromAddr, MERKLE, MERKLE_WANT, wants);
+}
+
+/**
+ * FUNCTION NAME: repairMessageHandler
+ *
+ * DESCRIPTION: Apply the records a co-replica sent that are newer than those held here.
+ * 				Without a ring no record is taken, as no range is shared.
+ */
+void MP2Node::repairMessageHandler(Message incomingMessage) {
+    if (snapshot->table.tokens.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < incomingMessage.entries.size(); i++) {
+        string &key = incomingMessage.entries[i].first;
+        string &record = incomingMessage.entries[i].second;
+        if (!sharesRange(snapshot->table.tokens[tokenIndexAt(hashFunction(key), snapshot->table)], incomingMessage.fromAddr)) {
+            continue;
+        }
+        if (applyRecord(key, record)) {
+            keysRepaired++;
+        }
+    }
+}
+
+/**
+ * FUNCTION NAME: applyRecord
+ *
+ * DESCRIPTION: Apply a record as a REPAIR or HINT carries it if it is newer than what is
+ * 				held here. Returns whether it was.
+ */
+bool MP2Node::applyRecord(const string &key, const string &record) {
+    size_t colon = record.find(':');
+    int written = stoi(record.substr(0, colon));
+    bool deleted = record.compare(colon + 1, 1, "D") == 0;
+    string value = deleted ? "" : record.substr(colon + 3);
+    if (!newerRecord(written, digestOf(key, deleted, value), recordTime(key), recordDigest(key))) {
+        return false;
+    }
+    if (deleted) {
+        removeKey(key, written);
+    } else {
+        storeKey(key, value, written);
+    }
+    return true;
+}
+
+/**
+ * FUNCTION NAME: sendEntries
+ *
+ * DESCRIPTION: Send entries as MERKLE or REPAIR messages, packed into as few as
+ * 				MAX_MSG_SIZE allows. The records of a leaf are kept in one message with
+ * 				the entry naming it.
+ */
+void MP2Node::sendEntries(Address *toAddr, MessageType type, int step, vector<pair<string, string> > &entries) {
+    bool byLeaf = type == MERKLE && step == MERKLE_KEYS;
+    vector<size_t> chunkStarts;
+    size_t chunkSize = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!byLeaf || entries[i].first.empty()) {
+            size_t groupSize = entrySize(entries[i]);
+            for (size_t j = i + 1; byLeaf && j < entries.size() && !entries[j].first.empty(); j++) {
+                groupSize += entrySize(entries[j]);
+            }
+            if (chunkStarts.empty() || chunkSize + groupSize > maxChunkSize()) {
+                chunkStarts.push_back(i);
+                chunkSize = 0;
+            }
+        }
+        chunkSize += entrySize(entries[i]);
+    }
+    chunkStarts.push_back(entries.size());
+
+    for (size_t i = 0; i + 1 < chunkStarts.size(); i++) {
+        vector<pair<string, string> > chunk(entries.begin() + chunkStarts[i], entries.begin() + chunkStarts[i + 1]);
+        Message msg(0, memberNode->addr, type, step, chunk);
+        sendMessage(toAddr, msg);
+        antiEntropyMessages++;
+    }
+}
 
 /*
  * UTILITY FUNCTIONS
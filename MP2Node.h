@@ -11,6 +11,7 @@
  * Header files
  */
 #include "stdincludes.h"
+#include <memory>
 #include "EmulNet.h"
 #include "Node.h"
 #include "HashTable.h"
@@ -18,6 +19,57 @@
 #include "Params.h"
 #include "Message.h"
 #include "Queue.h"
+#include "StableHash.h"
+#include "Partitioner.h"
+
+/**
+ * Macros
+ */
+#define PIGGYBACK_ENTRIES 4
+
+/**
+ * Key streams. A chunk is filled up to MAX_MSG_SIZE less KV_HEADER_ROOM, which covers
+ * the message header and a piggybacked membership digest. Up to STREAM_WINDOW chunks
+ * are in flight per stream, and without an ack for STREAM_ACK_TIMEOUT ticks the stream
+ * resumes from its last acked chunk, at most STREAM_MAX_RETRIES times in a row. A
+ * stream that is done or dropped is closed with a STREAM_ACK of STREAM_CLOSED, so that
+ * its node forgets the stream.
+ */
+#define KV_HEADER_ROOM 256
+#define STREAM_WINDOW 4
+#define STREAM_ACK_TIMEOUT 3
+#define STREAM_MAX_RETRIES 5
+#define STREAM_CLOSED -1
+
+/**
+ * Rebalancing. The keys held here are diffed REBALANCE_SCAN_SLICE at a time, and the
+ * scan pauses while STABILIZE_BUDGET chunks are already waiting to be sent.
+ */
+#define REBALANCE_SCAN_SLICE 64
+
+/**
+ * Anti-entropy. Every ANTI_ENTROPY_PERIOD ticks a node compares the Merkle trees of the
+ * token ranges it shares with one co-replica. A tree has MERKLE_FANOUT branches of
+ * MERKLE_FANOUT leaves each, and a deleted key is remembered for TOMBSTONE_TTL ticks so
+ * that a stale copy cannot bring it back.
+ */
+#define ANTI_ENTROPY_PERIOD 10
+#define MERKLE_FANOUT 8
+#define MERKLE_LEAF_COUNT (MERKLE_FANOUT * MERKLE_FANOUT)
+#define TOMBSTONE_TTL 300
+
+/**
+ * Hinted handoff. A coordinator replays the writes a replica missed after waiting
+ * HINT_BACKOFF_MIN ticks, doubling the wait up to HINT_BACKOFF_MAX while it gets no ack.
+ */
+#define HINT_BACKOFF_MIN 4
+#define HINT_BACKOFF_MAX 32
+
+/**
+ * Steps of a Merkle tree comparison, the cursor of a MERKLE message. The two nodes take
+ * turns, each answering the nodes that differ with the next level down.
+ */
+enum MerkleStep {MERKLE_ROOT, MERKLE_BRANCH, MERKLE_LEAF, MERKLE_KEYS, MERKLE_WANT};
 
 /**
  * CLASS NAME: MP2Node
@@ -34,8 +86,8 @@
 class MP2Node {
 private:
 
-	// Ring
-	vector<Node> ring;
+	// Membership version the ring was built from
+	long ringVersion;
 	// Hash Table
     HashTable * kvsHashTable;
 	// Member representing this member
@@ -49,6 +101,9 @@ private:
 
 	int initialized;
 
+	// Requests served as a replica, for the load stats
+	long requestsServed;
+
 	//Temporary Vectors which hold the values when the ring is reconstructed
 	//and when the stabalization protocol is called
 
@@ -61,6 +116,12 @@ private:
         int  count = 0;
         int failures = 0;
         bool complete= false;
+        set<string> acked;
+        //the replicas a write was sent to, which get hints for it if they miss it
+        vector<Address> replicas;
+        //with zones, the replica a read holds back and the tick it is asked anyway
+        vector<Address> deferred;
+        int hedgeAt = 0;
     };
 
 
@@ -68,6 +129,148 @@ private:
     //Maps the transaction id to values associated with it
     map<long, Transaction> transactions;
 
+    //Replicas of every ring position, compiled from a sorted ring. tokens holds the last
+    //position of each range the partitioner split the ring into and replicaSets the
+    //replicas of each range, or a single empty set while the ring has too few nodes to
+    //hold every replica. bucket[b] is the first token at or past the start of the b-th
+    //of RING_SIZE equal slices of the ring. members holds the addresses of the nodes on
+    //the ring
+    struct ReplicaTable {
+        vector<uint64_t> tokens;
+        vector<int> bucket;
+        vector<vector<Node> > replicaSets;
+        set<string> members;
+    };
+
+    //A ring sorted by hash code and its replica table. Every node with the same view of
+    //the membership shares one snapshot, which is const once built
+    struct RingSnapshot {
+        vector<Node> ring;
+        ReplicaTable table;
+    };
+
+    //The snapshots still in use, by the addresses of the members they were built from, and
+    //the snapshots this node built or found already built, for the stats
+    static map<string, weak_ptr<const RingSnapshot> > ringSnapshots;
+    long snapshotsBuilt;
+    long snapshotsShared;
+
+    //The snapshot of the current ring
+    shared_ptr<const RingSnapshot> snapshot;
+
+    //Places ring positions on replicas when a replica table is compiled
+    Partitioner *partitioner;
+
+    //The snapshot from before the ring changes not stabilized yet, the tick of the last of
+    //them, and whether they were all graceful leaves
+    shared_ptr<const RingSnapshot> unsettledSnapshot;
+    bool ringUnsettled;
+    int lastRingChange;
+    bool unsettledGracefulOnly;
+
+    //Ring changes other than graceful leaves, each of which would need a stabilization run
+    //of its own, and the runs made for them, for the stats
+    long ringChanges;
+    long stabilizationRuns;
+
+    //Quorums reached and the ticks they took, replicas held back by reads that had to be
+    //asked after all, and KV messages sent across zones, for the stats
+    long readQuorums;
+    long readQuorumTicks;
+    long writeQuorums;
+    long writeQuorumTicks;
+    long readsHedged;
+    long crossZoneMessages;
+
+    //Keys being streamed to one node. chunkStarts[i] is the first entry of chunk i, and
+    //chunkSize the size of the last chunk so far. Chunks below acked have been acked, and
+    //chunks below sent have been sent. While open the rebalance feeding the stream may
+    //still add to its last chunk, so that one is held back
+    struct KeyStream {
+        Address destination;
+        vector<pair<string, string> > entries;
+        vector<size_t> chunkStarts;
+        size_t chunkSize = 0;
+        bool open = false;
+        size_t acked = 0;
+        size_t sent = 0;
+        int started = 0;
+        int lastProgress = 0;
+        int retries = 0;
+    };
+
+    //What has been received of a stream: every chunk below expected, and the chunks
+    //past it that arrived early. Kept until the stream is closed or its node leaves
+    struct StreamCursor {
+        Address source;
+        int expected = 0;
+        set<int> ahead;
+    };
+
+    //Outgoing streams by stream id, and incoming ones by sender address and stream id
+    map<int, KeyStream> streams;
+    map<string, StreamCursor> streamCursors;
+    int nextStreamId;
+
+    //The rebalance after one ring change, run in the background. The keys held here are
+    //diffed between the tables of the old and new snapshots in key order, up to and
+    //including cursor so far, and the moved ones fed to the stream opened for each node
+    //that gains keys. The job holds on to both snapshots rather than copying them
+    struct RebalanceJob {
+        shared_ptr<const RingSnapshot> oldSnapshot;
+        shared_ptr<const RingSnapshot> newSnapshot;
+        string cursor;
+        bool begun = false;
+        map<string, int> streamIds;
+        long scanned = 0;
+        long moved = 0;
+        int started = 0;
+    };
+
+    //Rebalances still scanning, oldest first. Only the first one scans
+    deque<RebalanceJob> rebalanceJobs;
+
+    //Rebalance chunks sent so far and the most sent in one tick, for the stats
+    long chunksStreamed;
+    int peakChunksPerTick;
+
+    //Tick every key held here was last written, and every key deleted here in the last
+    //TOMBSTONE_TTL ticks. A key streamed or handed off here counts as written at tick 0
+    map<string, int> writeTimes;
+    map<string, int> tombstones;
+
+    //Merkle tree leaves of every token range, by the token ending the range. A leaf is
+    //the sum of the digests of its keys, so a write updates it in place
+    map<uint64_t, vector<uint64_t> > merkleLeaves;
+
+    //Anti-entropy rounds started, MERKLE and REPAIR messages sent, and keys repaired here
+    long antiEntropyRounds;
+    long antiEntropyMessages;
+    long keysRepaired;
+
+    //Writes a replica missed, kept here as its coordinator until the replica acks them.
+    //records holds the latest missed write of each key, as a REPAIR carries it. While the
+    //replica has not answered the last replay, only the first chunk is sent again
+    struct HintQueue {
+        map<string, string> records;
+        int nextReplay = 0;
+        int backoff = HINT_BACKOFF_MIN;
+        bool answered = true;
+    };
+
+    //A HINT message in flight, and the records it carries
+    struct HintChunk {
+        string destination;
+        vector<pair<string, string> > records;
+    };
+
+    //Hints by replica address, HINT messages by id, and the hint stats
+    map<string, HintQueue> hintQueues;
+    map<int, HintChunk> hintChunks;
+    int nextHintId;
+    long hintsStored;
+    long hintsDelivered;
+
 
 
 
@@ -77,11 +280,21 @@ public:
 	Member * getMemberNode() {
 		return this->memberNode;
 	}
+	long getHintsStored() {
+		return this->hintsStored;
+	}
+	long getHintsDelivered() {
+		return this->hintsDelivered;
+	}
 
 	// ring functionalities
 	void updateRing();
-	vector<Node> getMembershipList();
-    size_t hashFunction(string key);
+	void settleRing();
+	bool applyMembershipEvents(set<string> &members, bool &gracefulOnly);
+	void getMembershipList(set<string> &members);
+	shared_ptr<const RingSnapshot> internSnapshot(const set<string> &members);
+	void addTokens(vector<Node> &ringNodes, Address &address);
+    uint64_t hashFunction(const string &key);
 	void findNeighbors();
 
 	// client side CRUD APIs
@@ -97,11 +310,19 @@ public:
 	// handle messages from receiving queue
 	void checkMessages();
 
+	// send a message to another node
+	void sendMessage(const Address *toAddr, Message &message);
+
 	// coordinator dispatches messages to corresponding nodes
 	void dispatchMessages(Message message);
 
 	// find the addresses of nodes that are responsible for a key
-	vector<Node> findNodes(string key);
+	const vector<Node> &findNodes(const string &key);
+	const vector<Node> &findNodes(const string &key, const ReplicaTable &table);
+	const vector<Node> &findNodesAt(uint64_t position, const ReplicaTable &table);
+	size_t tokenIndexAt(uint64_t position, const ReplicaTable &table);
+	void buildReplicaTable(vector<Node> &ringNodes, ReplicaTable &table);
+	void boundReplicaLoads(vector<Node> &ringNodes, ReplicaTable &table);
 
 	// server
 	bool createKeyValue(string key, string value, ReplicaType replica);
@@ -110,7 +331,62 @@ public:
 	bool deletekey(string key);
 
 	// stabilization protocol - handle multiple failures
-	void stabilizationProtocol();
+	void stabilizationProtocol(shared_ptr<const RingSnapshot> oldSnapshot, shared_ptr<const RingSnapshot> newSnapshot);
+	void scanRebalance(size_t backlog);
+	void collectMovedKeys(const ReplicaTable &oldTable, const ReplicaTable &newTable,
+	                      map<string, vector<pair<string, string> > > &batches);
+	void gainedReplicas(uint64_t position, const ReplicaTable &oldTable, const ReplicaTable &newTable, vector<const Address *> &gained);
+	bool isRepairer(const vector<Node> &oldReplicas, const ReplicaTable &newTable);
+	int sendKeyBatches(map<string, vector<pair<string, string> > > &batches, int &messages);
+	void chunkEntries(vector<pair<string, string> > &entries, vector<size_t> &chunkStarts);
+	bool startsChunk(size_t &chunkSize, const pair<string, string> &entry);
+	size_t maxChunkSize();
+	size_t entrySize(const pair<string, string> &entry);
+
+	// key streams - acked, resumable transfer of the keys a node newly replicates
+	size_t readyChunks(KeyStream &stream);
+	bool sendNextChunk(int streamId, KeyStream &stream);
+	void advanceStreams();
+	void streamMessageHandler(Message incomingMessage);
+	void streamAckMessageHandler(Message incomingMessage);
+	void closeStream(int streamId, KeyStream &stream);
+
+	// write times, tombstones and the Merkle trees kept over them
+	void storeKey(const string &key, const string &value, int written);
+	bool removeKey(const string &key, int written);
+	void forgetKey(const string &key);
+	bool holdsRecord(const string &key);
+	uint64_t recordDigest(const string &key);
+	int recordTime(const string &key);
+	string encodeRecord(const string &key);
+	string leafOf(const string &key);
+	void merkleChange(const string &key, uint64_t before);
+	void rebuildMerkle();
+	void expireTombstones();
+	uint64_t merkleHash(uint64_t range, int step, int index);
+	void collectLeafKeys(set<string> &leaves, map<string, vector<string> > &keys);
+
+	// anti-entropy - find and repair the keys co-replicas disagree on
+	void runAntiEntropy();
+	bool sharesRange(uint64_t range, Address &peer);
+	void merkleMessageHandler(Message incomingMessage);
+	void compareKeys(Message &incomingMessage);
+	void repairMessageHandler(Message incomingMessage);
+	bool applyRecord(const string &key, const string &record);
+	void sendEntries(Address *toAddr, MessageType type, int step, vector<pair<string, string> > &entries);
+
+	// hinted handoff - replay the writes a replica missed once it answers again
+	void storeHints(Transaction &transaction);
+	void replayHints();
+	void hintMessageHandler(Message incomingMessage);
+	void hintAckMessageHandler(Message incomingMessage);
+
+	// graceful leave - hand the keys to their new replicas before going
+	void handOffKeys();
+	void handoffMessageHandler(Message incomingMessage);
+
+	// keys, requests and ring positions held by this node
+	void logLoadStats();
 
 	~MP2Node();
 
@@ -139,6 +415,11 @@ public:
 	//Transaction TImeout handler function
     void cleanUpTransactions();
 
+    //zones - ask the held back replica of reads the nearest replicas have not answered
+    int roundTrip(Address *peer);
+    void askDeferred(long transID, Transaction &t);
+    void hedgeReads();
+
 
     //utility functions
     bool isAddressInMembership(Address node);
@@ -31,7 +31,7 @@ Address& Address::operator =(const Address& anotherAddress) {
 /**
  * Compare two Address objects
  */
-bool Address::operator ==(const Address& anotherAddress) {
+bool Address::operator ==(const Address& anotherAddress) const {
 	return !memcmp(this->addr, anotherAddress.addr, sizeof(this->addr));
 }
 
@@ -152,6 +152,12 @@ Member::Member(const Member &anotherMember) {
 	this->pingCounter = anotherMember.pingCounter;
 	this->timeOutCounter = anotherMember.timeOutCounter;
 	this->memberList = anotherMember.memberList;
+	this->ringList = anotherMember.ringList;
+	this->membershipVersion = anotherMember.membershipVersion;
+	this->membershipEvents = anotherMember.membershipEvents;
+	this->kvDigests = anotherMember.kvDigests;
+	this->kvDigestSent = anotherMember.kvDigestSent;
+	this->kvDigestPeers = anotherMember.kvDigestPeers;
 	this->myPos = anotherMember.myPos;
 	this->mp1q = anotherMember.mp1q;
 	this->mp2q = anotherMember.mp2q;
@@ -170,8 +176,266 @@ Member& Member::operator =(const Member& anotherMember) {
 	this->pingCounter = anotherMember.pingCounter;
 	this->timeOutCounter = anotherMember.timeOutCounter;
 	this->memberList = anotherMember.memberList;
+	this->ringList = anotherMember.ringList;
+	this->membershipVersion = anotherMember.membershipVersion;
+	this->membershipEvents = anotherMember.membershipEvents;
+	this->kvDigests = anotherMember.kvDigests;
+	this->kvDigestSent = anotherMember.kvDigestSent;
+	this->kvDigestPeers = anotherMember.kvDigestPeers;
 	this->myPos = anotherMember.myPos;
 	this->mp1q = anotherMember.mp1q;
 	this->mp2q = anotherMember.mp2q;
 	return *this;
 }
+
+/**
+ * FUNCTION NAME: addMembershipEvent
+ *
+ * DESCRIPTION: Record a membership event under the next membership version
+ */
+void Member::addMembershipEvent(MembershipEventType type, Address &addr, bool graceful) {
+	membershipVersion++;
+	membershipEvents.push_back(MembershipEvent(type, addr, membershipVersion, graceful));
+	if (membershipEvents.size() > MAX_MEMBERSHIP_EVENTS) {
+		membershipEvents.pop_front();
+	}
+	if (type == MEMBER_LEFT) {
+		kvDigestSent.erase(string(addr.addr, sizeof(addr.addr)));
+	}
+}
+
+/**
+ * FUNCTION NAME: lowerBound
+ *
+ * DESCRIPTION: Position of the first entry not ordered before id and port
+ */
+size_t MemberTable::lowerBound(int id, short port) {
+	size_t low = 0;
+	size_t high = ids.size();
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (ids[mid] < id || (ids[mid] == id && ports[mid] < port)) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/**
+ * FUNCTION NAME: clear
+ *
+ * DESCRIPTION: Remove every entry
+ */
+void MemberTable::clear() {
+	ids.clear();
+	ports.clear();
+	heartbeats.clear();
+	timestamps.clear();
+	links.clear();
+	linkIds.clear();
+	linkPorts.clear();
+	linkPrev.clear();
+	linkNext.clear();
+	freeLinks.clear();
+	oldest = -1;
+	newest = -1;
+}
+
+/**
+ * FUNCTION NAME: find
+ *
+ * DESCRIPTION: Position of the entry for id and port, or -1 if there is none
+ */
+int MemberTable::find(int id, short port) {
+	size_t i = lowerBound(id, port);
+	if (i < ids.size() && ids[i] == id && ports[i] == port) {
+		return (int)i;
+	}
+	return -1;
+}
+
+/**
+ * FUNCTION NAME: insert
+ *
+ * DESCRIPTION: Add an entry in order and return its position. The caller checks the
+ *              member is not already there.
+ */
+int MemberTable::insert(int id, short port, long heartbeat, long timestamp) {
+	size_t i = lowerBound(id, port);
+	ids.insert(ids.begin() + i, id);
+	ports.insert(ports.begin() + i, port);
+	heartbeats.insert(heartbeats.begin() + i, (int32_t)heartbeat);
+	timestamps.insert(timestamps.begin() + i, (int32_t)timestamp);
+	int32_t link = newLink(id, port);
+	links.insert(links.begin() + i, link);
+	append(link);
+	return (int)i;
+}
+
+/**
+ * FUNCTION NAME: erase
+ *
+ * DESCRIPTION: Remove the entry at position i
+ */
+void MemberTable::erase(size_t i) {
+	unlink(links[i]);
+	freeLinks.push_back(links[i]);
+	links.erase(links.begin() + i);
+	ids.erase(ids.begin() + i);
+	ports.erase(ports.begin() + i);
+	heartbeats.erase(heartbeats.begin() + i);
+	timestamps.erase(timestamps.begin() + i);
+}
+
+/**
+ * FUNCTION NAME: erase
+ *
+ * DESCRIPTION: Remove the entries at the given ordered positions, compacting the columns
+ *              in one pass
+ */
+void MemberTable::erase(const vector<size_t> &positions) {
+	if (positions.empty()) {
+		return;
+	}
+	size_t next = 0;
+	size_t kept = 0;
+	for (size_t i = 0; i < ids.size(); i++) {
+		if (next < positions.size() && positions[next] == i) {
+			unlink(links[i]);
+			freeLinks.push_back(links[i]);
+			next++;
+			continue;
+		}
+		ids[kept] = ids[i];
+		ports[kept] = ports[i];
+		heartbeats[kept] = heartbeats[i];
+		timestamps[kept] = timestamps[i];
+		links[kept] = links[i];
+		kept++;
+	}
+	ids.resize(kept);
+	ports.resize(kept);
+	heartbeats.resize(kept);
+	timestamps.resize(kept);
+	links.resize(kept);
+}
+
+/**
+ * FUNCTION NAME: settimestamp
+ *
+ * DESCRIPTION: Set the time the entry at position i was last updated, which makes it
+ *              the newest in the update order
+ */
+void MemberTable::settimestamp(size_t i, long timestamp) {
+	timestamps[i] = (int32_t)timestamp;
+	unlink(links[i]);
+	append(links[i]);
+}
+
+/**
+ * FUNCTION NAME: collectStale
+ *
+ * DESCRIPTION: Collect the positions of the entries last updated at or before cutoff, in
+ *              order. Only the stale entries and the first fresh one are looked at.
+ */
+void MemberTable::collectStale(long cutoff, vector<size_t> &positions) {
+	for (int32_t link = oldest; link >= 0; link = linkNext[link]) {
+		int i = find(linkIds[link], linkPorts[link]);
+		if (timestamps[i] > cutoff) {
+			break;
+		}
+		positions.push_back(i);
+	}
+	sort(positions.begin(), positions.end());
+}
+
+/**
+ * FUNCTION NAME: collectNewest
+ *
+ * DESCRIPTION: Collect the positions of the count most recently updated entries, newest first
+ */
+void MemberTable::collectNewest(size_t count, vector<size_t> &positions) {
+	for (int32_t link = newest; link >= 0 && positions.size() < count; link = linkPrev[link]) {
+		positions.push_back(find(linkIds[link], linkPorts[link]));
+	}
+}
+
+/**
+ * FUNCTION NAME: newLink
+ *
+ * DESCRIPTION: Take a free update order link for an entry, growing the links if none is free
+ */
+int32_t MemberTable::newLink(int id, short port) {
+	int32_t link;
+	if (!freeLinks.empty()) {
+		link = freeLinks.back();
+		freeLinks.pop_back();
+	} else {
+		link = (int32_t)linkIds.size();
+		linkIds.push_back(0);
+		linkPorts.push_back(0);
+		linkPrev.push_back(-1);
+		linkNext.push_back(-1);
+	}
+	linkIds[link] = id;
+	linkPorts[link] = port;
+	return link;
+}
+
+/**
+ * FUNCTION NAME: append
+ *
+ * DESCRIPTION: Make a link the newest in the update order
+ */
+void MemberTable::append(int32_t link) {
+	linkPrev[link] = newest;
+	linkNext[link] = -1;
+	if (newest >= 0) {
+		linkNext[newest] = link;
+	} else {
+		oldest = link;
+	}
+	newest = link;
+}
+
+/**
+ * FUNCTION NAME: unlink
+ *
+ * DESCRIPTION: Take a link out of the update order
+ */
+void MemberTable::unlink(int32_t link) {
+	if (linkPrev[link] >= 0) {
+		linkNext[linkPrev[link]] = linkNext[link];
+	} else {
+		oldest = linkNext[link];
+	}
+	if (linkNext[link] >= 0) {
+		linkPrev[linkNext[link]] = linkPrev[link];
+	} else {
+		newest = linkPrev[link];
+	}
+}
+
+/**
+ * FUNCTION NAME: at
+ *
+ * DESCRIPTION: Copy of the entry at position i
+ */
+MemberListEntry MemberTable::at(size_t i) {
+	return MemberListEntry(ids[i], ports[i], heartbeats[i], timestamps[i]);
+}
+
+/**
+ * FUNCTION NAME: bytesUsed
+ *
+ * DESCRIPTION: Memory held by the columns
+ */
+size_t MemberTable::bytesUsed() const {
+	return ids.capacity() * sizeof(int32_t) + ports.capacity() * sizeof(int16_t)
+			+ heartbeats.capacity() * sizeof(int32_t) + timestamps.capacity() * sizeof(int32_t)
+			+ links.capacity() * sizeof(int32_t) + linkIds.capacity() * sizeof(int32_t)
+			+ linkPorts.capacity() * sizeof(int16_t) + linkPrev.capacity() * sizeof(int32_t)
+			+ linkNext.capacity() * sizeof(int32_t) + freeLinks.capacity() * sizeof(int32_t);
+}
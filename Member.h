@@ -9,6 +9,14 @@
 
 #include "stdincludes.h"
 
+/**
+ * Macros
+ */
+// membership events kept for MP2Node, which rebuilds its ring if it falls further behind
+#define MAX_MEMBERSHIP_EVENTS 1000
+
+enum MembershipEventType { MEMBER_JOINED, MEMBER_LEFT };
+
 /**
  * CLASS NAME: q_elt
  *
@@ -34,7 +42,7 @@ public:
 	Address(const Address &anotherAddress);
 	 // Overloaded = operator
 	Address& operator =(const Address &anotherAddress);
-	bool operator ==(const Address &anotherAddress);
+	bool operator ==(const Address &anotherAddress) const;
 	Address(string address) {
 		size_t pos = address.find(":");
 		int id = stoi(address.substr(0, pos));
@@ -42,13 +50,19 @@ public:
 		memcpy(&addr[0], &id, sizeof(int));
 		memcpy(&addr[4], &port, sizeof(short));
 	}
-	string getAddress() {
+	string getAddress() const {
 		int id = 0;
 		short port;
 		memcpy(&id, &addr[0], sizeof(int));
 		memcpy(&port, &addr[4], sizeof(short));
 		return to_string(id) + ":" + to_string(port);
 	}
+	// The zone of the node among the given number of zones, dealt out by id
+	int getZone(int zones) const {
+		int id = 0;
+		memcpy(&id, &addr[0], sizeof(int));
+		return zones > 1 ? (id - 1) % zones : 0;
+	}
 	void init() {
 		memset(&addr, 0, sizeof(addr));
 	}
@@ -80,6 +94,77 @@ public:
 	void settimestamp(long timestamp);
 };
 
+/**
+ * CLASS NAME: MemberTable
+ *
+ * DESCRIPTION: The membership list, held as parallel columns kept sorted by id and
+ *              port. An entry takes 14 bytes against 24 for a MemberListEntry, and
+ *              members are found by binary search with no separate index. Heartbeats
+ *              and timestamps are in ticks and fit in 32 bits. Inserting or erasing an
+ *              entry moves the position of the entries after it.
+ *
+ *              The entries are also linked in the order they were last updated, which
+ *              is the order they time out in, so the stale ones are found without a
+ *              scan. This holds as long as timestamps are only ever set to the current
+ *              time. The links take another 18 bytes an entry.
+ */
+class MemberTable {
+private:
+	vector<int32_t> ids;
+	vector<int16_t> ports;
+	vector<int32_t> heartbeats;
+	vector<int32_t> timestamps;
+	// update order link of each entry
+	vector<int32_t> links;
+	// update order, indexed by link, oldest first
+	vector<int32_t> linkIds;
+	vector<int16_t> linkPorts;
+	vector<int32_t> linkPrev;
+	vector<int32_t> linkNext;
+	vector<int32_t> freeLinks;
+	int32_t oldest;
+	int32_t newest;
+	size_t lowerBound(int id, short port);
+	int32_t newLink(int id, short port);
+	void append(int32_t link);
+	void unlink(int32_t link);
+public:
+	MemberTable(): oldest(-1), newest(-1) {}
+	size_t size() const { return ids.size(); }
+	bool empty() const { return ids.empty(); }
+	void clear();
+	int find(int id, short port);
+	int insert(int id, short port, long heartbeat, long timestamp);
+	void erase(size_t i);
+	void erase(const vector<size_t> &positions);
+	MemberListEntry at(size_t i);
+	int getid(size_t i) { return ids[i]; }
+	short getport(size_t i) { return ports[i]; }
+	long getheartbeat(size_t i) { return heartbeats[i]; }
+	long gettimestamp(size_t i) { return timestamps[i]; }
+	void setheartbeat(size_t i, long heartbeat) { heartbeats[i] = (int32_t)heartbeat; }
+	void settimestamp(size_t i, long timestamp);
+	void collectStale(long cutoff, vector<size_t> &positions);
+	void collectNewest(size_t count, vector<size_t> &positions);
+	size_t bytesUsed() const;
+};
+
+/**
+ * CLASS NAME: MembershipEvent
+ *
+ * DESCRIPTION: A member joining or leaving the membership list, numbered by the
+ *              membership version it produced. A graceful leave was announced by the
+ *              member, which handed its keys off before going.
+ */
+class MembershipEvent {
+public:
+	MembershipEventType type;
+	Address addr;
+	long version;
+	bool graceful;
+	MembershipEvent(MembershipEventType type, Address addr, long version, bool graceful): type(type), addr(addr), version(version), graceful(graceful) {}
+};
+
 /**
  * CLASS NAME: Member
  *
@@ -105,7 +190,20 @@ public:
 	// counter for ping timeout
 	int timeOutCounter;
 	// Membership table
-	vector<MemberListEntry> memberList;
+	MemberTable memberList;
+	// Ring members, disseminated apart from the membership table in partial view modes
+	vector<Address> ringList;
+	// Bumped by every membership event
+	long membershipVersion;
+	// The last MAX_MEMBERSHIP_EVENTS membership events, oldest first
+	deque<MembershipEvent> membershipEvents;
+	// Membership entries carried by KV messages, waiting for the membership protocol
+	vector<pair<Address, long> > kvDigests;
+	// When a digest last went out on a KV message, by peer address, kept while the
+	// peer is a member
+	map<string, int> kvDigestSent;
+	// Peers sent a digest since the membership protocol last gossiped
+	int kvDigestPeers;
 	// My position in the membership table
 	vector<MemberListEntry>::iterator myPos;
 	// Queue for failure detection messages
@@ -115,11 +213,13 @@ public:
 	/**
 	 * Constructor
 	 */
-	Member(): inited(false), inGroup(false), bFailed(false), nnb(0), heartbeat(0), pingCounter(0), timeOutCounter(0) {}
+	Member(): inited(false), inGroup(false), bFailed(false), nnb(0), heartbeat(0), pingCounter(0), timeOutCounter(0), membershipVersion(0), kvDigestPeers(0) {}
 	// copy constructor
 	Member(const Member &anotherMember);
 	// Assignment operator overloading
 	Member& operator =(const Member &anotherMember);
+	// Record a membership event
+	void addMembershipEvent(MembershipEventType type, Address &addr, bool graceful = false);
 	virtual ~Member() {}
 };
 
@@ -14,8 +14,33 @@
 // transID::fromAddr::DELETE::key
 // transID::fromAddr::REPLY::sucess
 // transID::fromAddr::READREPLY::value
+// transID::fromAddr::HANDOFF::key::value::key::value...
+// transID::fromAddr::STREAM::cursor::key::value::key::value...
+// transID::fromAddr::STREAM_ACK::cursor
+// transID::fromAddr::MERKLE::step::node::hash::node::hash...
+// transID::fromAddr::REPAIR::0::key::record::key::record...
+// transID::fromAddr::HINT::0::key::record::key::record...
+// transID::fromAddr::HINT_ACK::0
+// any of them may start with ##id:port:heartbeat##id:port:heartbeat...:: ahead of the
+// transID. The digest holds no "::" and a transID no '#', so keys and values may hold
+// "##".
 Message::Message(string message){
 	this->delimiter = "::";
+	this->digestDelimiter = "##";
+	if (message.compare(0, digestDelimiter.size(), digestDelimiter) == 0) {
+		size_t digestEnd = message.find(delimiter);
+		if (digestEnd == string::npos)
+			digestEnd = message.size();
+		size_t start = 2;
+		while (start < digestEnd) {
+			size_t end = min(message.find(digestDelimiter, start), digestEnd);
+			string entry = message.substr(start, end - start);
+			size_t hbPos = entry.rfind(":");
+			digest.push_back(make_pair(Address(entry.substr(0, hbPos)), stol(entry.substr(hbPos + 1))));
+			start = end + 2;
+		}
+		message = message.substr(min(digestEnd + 2, message.size()));
+	}
 	vector<string> tuple;
 	size_t pos = message.find(delimiter);
 	size_t start = 0;
@@ -52,6 +77,22 @@ Message::Message(string message){
 		case READREPLY:
 			value = tuple.at(3);
 			break;
+		case HANDOFF:
+			for (size_t i = 3; i + 1 < tuple.size(); i += 2)
+				entries.push_back(make_pair(tuple.at(i), tuple.at(i + 1)));
+			break;
+		case STREAM:
+		case MERKLE:
+		case REPAIR:
+		case HINT:
+		case HINT_ACK:
+			cursor = stoi(tuple.at(3));
+			for (size_t i = 4; i + 1 < tuple.size(); i += 2)
+				entries.push_back(make_pair(tuple.at(i), tuple.at(i + 1)));
+			break;
+		case STREAM_ACK:
+			cursor = stoi(tuple.at(3));
+			break;
 	}
 }
 
@@ -61,6 +102,7 @@ Message::Message(string message){
 // construct a create or update message
 Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key, string _value, ReplicaType _replica){
 	this->delimiter = "::";
+	this->digestDelimiter = "##";
 	transID = _transID;
 	fromAddr = _fromAddr;
 	type = _type;
@@ -74,6 +116,8 @@ Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key
  */
 Message::Message(const Message& anotherMessage) {
 	this->delimiter = anotherMessage.delimiter;
+	this->digestDelimiter = anotherMessage.digestDelimiter;
+	this->digest = anotherMessage.digest;
 	this->fromAddr = anotherMessage.fromAddr;
 	this->key = anotherMessage.key;
 	this->replica = anotherMessage.replica;
@@ -81,6 +125,8 @@ Message::Message(const Message& anotherMessage) {
 	this->transID = anotherMessage.transID;
 	this->type = anotherMessage.type;
 	this->value = anotherMessage.value;
+	this->entries = anotherMessage.entries;
+	this->cursor = anotherMessage.cursor;
 }
 
 /**
@@ -88,6 +134,7 @@ Message::Message(const Message& anotherMessage) {
  */
 Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key, string _value){
 	this->delimiter = "::";
+	this->digestDelimiter = "##";
 	transID = _transID;
 	fromAddr = _fromAddr;
 	type = _type;
@@ -101,6 +148,7 @@ Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key
 // construct a read or delete message
 Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key){
 	this->delimiter = "::";
+	this->digestDelimiter = "##";
 	transID = _transID;
 	fromAddr = _fromAddr;
 	type = _type;
@@ -113,6 +161,7 @@ Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key
 // construct reply message
 Message::Message(int _transID, Address _fromAddr, MessageType _type, bool _success){
 	this->delimiter = "::";
+	this->digestDelimiter = "##";
 	transID = _transID;
 	fromAddr = _fromAddr;
 	type = _type;
@@ -125,19 +174,79 @@ Message::Message(int _transID, Address _fromAddr, MessageType _type, bool _succe
 // construct read reply message
 Message::Message(int _transID, Address _fromAddr, string _value){
 	this->delimiter = "::";
+	this->digestDelimiter = "##";
 	transID = _transID;
 	fromAddr = _fromAddr;
 	type = READREPLY;
 	value = _value;
 }
 
+/**
+ * Constructor
+ */
+// construct handoff message
+Message::Message(int _transID, Address _fromAddr, vector<pair<string, string> > _entries){
+	this->delimiter = "::";
+	this->digestDelimiter = "##";
+	transID = _transID;
+	fromAddr = _fromAddr;
+	type = HANDOFF;
+	entries = _entries;
+}
+
+/**
+ * Constructor
+ */
+// construct stream chunk message
+Message::Message(int _transID, Address _fromAddr, int _cursor, vector<pair<string, string> > _entries){
+	this->delimiter = "::";
+	this->digestDelimiter = "##";
+	transID = _transID;
+	fromAddr = _fromAddr;
+	type = STREAM;
+	cursor = _cursor;
+	entries = _entries;
+}
+
+/**
+ * Constructor
+ */
+// construct stream ack message
+Message::Message(int _transID, Address _fromAddr, int _cursor){
+	this->delimiter = "::";
+	this->digestDelimiter = "##";
+	transID = _transID;
+	fromAddr = _fromAddr;
+	type = STREAM_ACK;
+	cursor = _cursor;
+}
+
+/**
+ * Constructor
+ */
+// construct anti-entropy or hinted handoff message
+Message::Message(int _transID, Address _fromAddr, MessageType _type, int _cursor, vector<pair<string, string> > _entries){
+	this->delimiter = "::";
+	this->digestDelimiter = "##";
+	transID = _transID;
+	fromAddr = _fromAddr;
+	type = _type;
+	cursor = _cursor;
+	entries = _entries;
+}
+
 /**
  * FUNCTION NAME: toString
  *
  * DESCRIPTION: Serialized Message in string format
  */
 string Message::toString(){
-	string message = to_string(transID) + delimiter + fromAddr.getAddress() + delimiter + to_string(type) + delimiter;
+	string message;
+	for (size_t i = 0; i < digest.size(); i++)
+		message += digestDelimiter + digest[i].first.getAddress() + ":" + to_string(digest[i].second);
+	if (!digest.empty())
+		message += delimiter;
+	message += to_string(transID) + delimiter + fromAddr.getAddress() + delimiter + to_string(type) + delimiter;
 	switch(type){
 		case CREATE:
 		case UPDATE:
@@ -156,6 +265,25 @@ string Message::toString(){
 		case READREPLY:
 			message += value;
 			break;
+		case HANDOFF:
+			for (size_t i = 0; i < entries.size(); i++) {
+				if (i > 0)
+					message += delimiter;
+				message += entries[i].first + delimiter + entries[i].second;
+			}
+			break;
+		case STREAM:
+		case MERKLE:
+		case REPAIR:
+		case HINT:
+		case HINT_ACK:
+			message += to_string(cursor);
+			for (size_t i = 0; i < entries.size(); i++)
+				message += delimiter + entries[i].first + delimiter + entries[i].second;
+			break;
+		case STREAM_ACK:
+			message += to_string(cursor);
+			break;
 	}
 	return message;
 }
@@ -165,6 +293,8 @@ string Message::toString(){
  */
 Message& Message::operator =(const Message& anotherMessage) {
 	this->delimiter = anotherMessage.delimiter;
+	this->digestDelimiter = anotherMessage.digestDelimiter;
+	this->digest = anotherMessage.digest;
 	this->fromAddr = anotherMessage.fromAddr;
 	this->key = anotherMessage.key;
 	this->replica = anotherMessage.replica;
@@ -172,5 +302,7 @@ Message& Message::operator =(const Message& anotherMessage) {
 	this->transID = anotherMessage.transID;
 	this->type = anotherMessage.type;
 	this->value = anotherMessage.value;
+	this->entries = anotherMessage.entries;
+	this->cursor = anotherMessage.cursor;
 	return *this;
 }
@@ -24,8 +24,13 @@ public:
 	Address fromAddr;
 	int transID;
 	bool success; // success or not 
+	vector<pair<string, string> > entries; // key value pairs of a HANDOFF, STREAM, MERKLE, REPAIR or HINT
+	int cursor; // chunk number of a STREAM, next chunk expected for a STREAM_ACK, step of a MERKLE
+	vector<pair<Address, long> > digest; // piggybacked membership entries and their heartbeats
 	// delimiter
 	string delimiter;
+	// delimiter of the piggybacked membership digest
+	string digestDelimiter;
 	// construct a message from a string
 	Message(string message);
 	Message(const Message& anotherMessage);
@@ -38,6 +43,14 @@ public:
 	Message(int _transID, Address _fromAddr, MessageType _type, bool _success);
 	// construct read reply message
 	Message(int _transID, Address _fromAddr, string _value);
+	// construct handoff message
+	Message(int _transID, Address _fromAddr, vector<pair<string, string> > _entries);
+	// construct stream chunk message
+	Message(int _transID, Address _fromAddr, int _cursor, vector<pair<string, string> > _entries);
+	// construct stream ack message
+	Message(int _transID, Address _fromAddr, int _cursor);
+	// construct anti-entropy or hinted handoff message
+	Message(int _transID, Address _fromAddr, MessageType _type, int _cursor, vector<pair<string, string> > _entries);
 	Message& operator = (const Message& anotherMessage);
 	// serialize to a string
 	string toString();
@@ -9,13 +9,14 @@
 /**
  * constructor
  */
-Node::Node() {}
+Node::Node(): nodeHashCode(0), nodeToken(0) {}
 
 /**
  * constructor
  */
-Node::Node(Address address) {
+Node::Node(Address address, int token) {
 	this->nodeAddress = address;
+	this->nodeToken = token;
 	computeHashCode();
 }
 
@@ -27,10 +28,17 @@ Node::~Node() {}
 /**
  * FUNCTION NAME: computeHashCode
  *
- * DESCRIPTION: This function computes the hash code of the node address
+ * DESCRIPTION: This function computes the hash code of the node address, that is the
+ * 				position on the ring of this token. All six address bytes are hashed,
+ * 				followed by the token number as four little endian bytes.
  */
 void Node::computeHashCode() {
-	nodeHashCode = hashFunc(nodeAddress.addr)%RING_SIZE;
+	char bytes[sizeof(nodeAddress.addr) + 4];
+	memcpy(bytes, nodeAddress.addr, sizeof(nodeAddress.addr));
+	for (int i = 0; i < 4; i++) {
+		bytes[sizeof(nodeAddress.addr) + i] = (char)((unsigned)nodeToken >> (8 * i));
+	}
+	nodeHashCode = stableHash(bytes, sizeof(bytes));
 }
 
 /**
@@ -39,6 +47,7 @@ void Node::computeHashCode() {
 Node::Node(const Node& another) {
 	this->nodeAddress = another.nodeAddress;
 	this->nodeHashCode = another.nodeHashCode;
+	this->nodeToken = another.nodeToken;
 }
 
 /**
@@ -47,6 +56,7 @@ Node::Node(const Node& another) {
 Node& Node::operator=(const Node& another) {
 	this->nodeAddress = another.nodeAddress;
 	this->nodeHashCode = another.nodeHashCode;
+	this->nodeToken = another.nodeToken;
 	return *this;
 }
 
@@ -62,7 +72,7 @@ bool Node::operator < (const Node& another) const {
  *
  * DESCRIPTION: return hash code of the node
  */
-size_t Node::getHashCode() {
+uint64_t Node::getHashCode() const {
 	return nodeHashCode;
 }
 
@@ -75,12 +85,21 @@ Address * Node::getAddress() {
 	return &nodeAddress;
 }
 
+/**
+ * FUNCTION NAME: getAddress
+ *
+ * DESCRIPTION: return the address of a node that is not to be changed
+ */
+const Address * Node::getAddress() const {
+	return &nodeAddress;
+}
+
 /**
  * FUNCTION NAME: setHashCode
  *
  * DESCRIPTION: set the hash code of the node
  */
-void Node::setHashCode(size_t hashCode) {
+void Node::setHashCode(uint64_t hashCode) {
 	this->nodeHashCode = hashCode;
 }
 
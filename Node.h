@@ -9,21 +9,23 @@
 
 #include "stdincludes.h"
 #include "Member.h"
+#include "StableHash.h"
 
 class Node {
 public:
 	Address nodeAddress;
-	size_t nodeHashCode;
-	std::hash<string> hashFunc;
+	uint64_t nodeHashCode;
+	int nodeToken;
 	Node();
-	Node(Address address);
+	Node(Address address, int token = 0);
 	Node(const Node& another);
 	Node& operator=(const Node& another);
 	bool operator < (const Node& another) const;
 	void computeHashCode();
-	size_t getHashCode();
+	uint64_t getHashCode() const;
 	Address * getAddress();
-	void setHashCode(size_t hashCode);
+	const Address * getAddress() const;
+	void setHashCode(uint64_t hashCode);
 	void setAddress(Address address);
 	virtual ~Node();
 };
@@ -19,8 +19,29 @@ Params::Params(): PORTNUM(8001) {}
 void Params::setparams(char *config_file) {
 	//trace.funcEntry("Params::setparams");
 	char CRUD[10];
+	char option[64];
+	int value;
 	FILE *fp = fopen(config_file,"r");
 
+	// defaults for the optional tuning parameters
+	GOSSIP_DELTA = 0;
+	MEMBERSHIP_MODE = GOSSIP_MEMBERSHIP;
+	FAILURE_DETECTOR = TIMEOUT_DETECTOR;
+	PHI_THRESHOLD = 8;
+	GRACEFUL_LEAVE = 0;
+	NUM_INTRODUCERS = 4;
+	GOSSIP_FANOUT = 0;
+	PUSH_PULL = 0;
+	PIGGYBACK_GOSSIP = 0;
+	VNODES = 1;
+	STABILIZE_BUDGET = 8;
+	RING_SETTLE = 3;
+	LOAD_BOUND = 0;
+	PARTITIONER = 0;
+	NUM_ZONES = 1;
+	ZONE_LATENCY = 0;
+	SCENARIO = NO_SCENARIO;
+
 	fscanf(fp,"MAX_NNB: %d", &MAX_NNB);
 	fscanf(fp,"\nSINGLE_FAILURE: %d", &SINGLE_FAILURE);
 	fscanf(fp,"\nDROP_MSG: %d", &DROP_MSG);
@@ -40,6 +61,11 @@ void Params::setparams(char *config_file) {
 		this->CRUDTEST = DELETE_TEST;
 	}
 
+	// optional tuning parameters follow as "NAME: value" lines, in any order
+	while ( fscanf(fp," %63[^:]: %d", option, &value) == 2 ) {
+		setoption(option, value);
+	}
+
 	//printf("Parameters of the test case: %d %d %d %lf\n", MAX_NNB, SINGLE_FAILURE, DROP_MSG, MSG_DROP_PROB);
 
 	EN_GPSZ = MAX_NNB;
@@ -56,6 +82,68 @@ void Params::setparams(char *config_file) {
 	return;
 }
 
+/**
+ * FUNCTION NAME: setoption
+ *
+ * DESCRIPTION: Set one of the optional tuning parameters by name
+ */
+void Params::setoption(const char *name, int value) {
+	if ( 0 == strcmp(name, "GOSSIP_DELTA") ) {
+		GOSSIP_DELTA = value;
+	}
+	else if ( 0 == strcmp(name, "MEMBERSHIP_MODE") ) {
+		MEMBERSHIP_MODE = value;
+	}
+	else if ( 0 == strcmp(name, "FAILURE_DETECTOR") ) {
+		FAILURE_DETECTOR = value;
+	}
+	else if ( 0 == strcmp(name, "PHI_THRESHOLD") ) {
+		PHI_THRESHOLD = value;
+	}
+	else if ( 0 == strcmp(name, "GRACEFUL_LEAVE") ) {
+		GRACEFUL_LEAVE = value;
+	}
+	else if ( 0 == strcmp(name, "NUM_INTRODUCERS") ) {
+		NUM_INTRODUCERS = value;
+	}
+	else if ( 0 == strcmp(name, "GOSSIP_FANOUT") ) {
+		GOSSIP_FANOUT = value;
+	}
+	else if ( 0 == strcmp(name, "PUSH_PULL") ) {
+		PUSH_PULL = value;
+	}
+	else if ( 0 == strcmp(name, "PIGGYBACK_GOSSIP") ) {
+		PIGGYBACK_GOSSIP = value;
+	}
+	else if ( 0 == strcmp(name, "VNODES") ) {
+		VNODES = value;
+	}
+	else if ( 0 == strcmp(name, "STABILIZE_BUDGET") ) {
+		STABILIZE_BUDGET = value;
+	}
+	else if ( 0 == strcmp(name, "RING_SETTLE") ) {
+		RING_SETTLE = value;
+	}
+	else if ( 0 == strcmp(name, "LOAD_BOUND") ) {
+		LOAD_BOUND = value;
+	}
+	else if ( 0 == strcmp(name, "PARTITIONER") ) {
+		PARTITIONER = value;
+	}
+	else if ( 0 == strcmp(name, "NUM_ZONES") ) {
+		NUM_ZONES = value;
+	}
+	else if ( 0 == strcmp(name, "ZONE_LATENCY") ) {
+		ZONE_LATENCY = value;
+	}
+	else if ( 0 == strcmp(name, "SCENARIO") ) {
+		SCENARIO = value;
+	}
+	else {
+		printf("Unknown parameter %s ignored\n", name);
+	}
+}
+
 /**
  * FUNCTION NAME: getcurrtime
  *
@@ -12,6 +12,9 @@
 #include "Member.h"
 
 enum testTYPE { CREATE_TEST, READ_TEST, UPDATE_TEST, DELETE_TEST };
+enum membershipMODE { GOSSIP_MEMBERSHIP, SWIM_MEMBERSHIP, HYPARVIEW_MEMBERSHIP };
+enum failureDETECTOR { TIMEOUT_DETECTOR, PHI_ACCRUAL_DETECTOR };
+enum scenarioTYPE { NO_SCENARIO, REPAIR_SCENARIO, HINT_SCENARIO, SWAP_SCENARIO, ZONE_SCENARIO };
 
 /**
  * CLASS NAME: Params
@@ -32,8 +35,26 @@ public:
 	int allNodesJoined;
 	short PORTNUM;
 	int CRUDTEST;
+	int GOSSIP_DELTA;			// send only membership entries changed since a peer was last told
+	int MEMBERSHIP_MODE;		// membershipMODE run by MP1Node
+	int FAILURE_DETECTOR;		// failureDETECTOR used by gossip membership
+	int PHI_THRESHOLD;			// phi above which a member is removed
+	int GRACEFUL_LEAVE;			// failed nodes hand their keys off and announce they are leaving
+	int NUM_INTRODUCERS;		// the first nodes to start answer join requests between them
+	int GOSSIP_FANOUT;			// peers gossiped to per tick, 0 scales it with the group size
+	int PUSH_PULL;				// gossip peers answer with their own member table
+	int PIGGYBACK_GOSSIP;		// KV messages carry a membership digest in place of some gossip
+	int VNODES;					// tokens each node holds on the consistent hashing ring
+	int STABILIZE_BUDGET;		// rebalance chunks a node sends per tick, 0 for no limit
+	int RING_SETTLE;			// ticks the ring must stand still before it is stabilized
+	int LOAD_BOUND;				// most a node may replicate, in percent over the mean, 0 for no bound
+	int PARTITIONER;			// replica placement: 0 ring, 1 rendezvous, 2 jump hash
+	int NUM_ZONES;				// zones the nodes are dealt out over by id, replicas spread across them
+	int ZONE_LATENCY;			// ticks a message takes on top of the usual one to cross zones
+	int SCENARIO;				// scenarioTYPE of the scenario test run alongside the CRUD test
 	Params();
 	void setparams(char *);
+	void setoption(const char *name, int value);
 	int getcurrtime();
 };
 
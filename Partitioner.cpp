@@ -0,0 +1,279 @@
+/**********************************
+ * FILE NAME: Partitioner.cpp
+ *
+ * DESCRIPTION: Definition of the partitioners placing ring positions on replicas
+ **********************************/
+
+#include "Partitioner.h"
+
+/**
+ * FUNCTION NAME: sameNode
+ *
+ * DESCRIPTION: Whether two ring entries belong to the same node
+ */
+static bool sameNode(Node &a, Node &b) {
+	return memcmp(a.getAddress()->addr, b.getAddress()->addr, sizeof(a.getAddress()->addr)) == 0;
+}
+
+/**
+ * FUNCTION NAME: distinctNodes
+ *
+ * DESCRIPTION: One entry per node of a ring, sorted by address, so that the slice
+ * 				partitioners see the same nodes in the same order whatever the tokens
+ */
+static void distinctNodes(vector<Node> &ringNodes, vector<Node> &nodes) {
+	nodes = ringNodes;
+	sort(nodes.begin(), nodes.end(), [](Node &a, Node &b) {
+		return memcmp(a.getAddress()->addr, b.getAddress()->addr, sizeof(a.getAddress()->addr)) < 0;
+	});
+	nodes.erase(unique(nodes.begin(), nodes.end(), sameNode), nodes.end());
+}
+
+/**
+ * FUNCTION NAME: putSlice
+ *
+ * DESCRIPTION: Write the first position of a slice as 8 little endian bytes, for hashing
+ */
+static void putSlice(char *bytes, uint64_t start) {
+	for (int i = 0; i < 8; i++) {
+		bytes[i] = (char)(start >> (8 * i));
+	}
+}
+
+/**
+ * FUNCTION NAME: passes
+ *
+ * DESCRIPTION: The passes made over the candidates for a replica set. With zones the
+ * 				first pass only takes nodes in zones not picked yet.
+ */
+int Partitioner::passes() {
+	return zones > 1 ? 2 : 1;
+}
+
+/**
+ * FUNCTION NAME: fits
+ *
+ * DESCRIPTION: Whether a candidate may join a replica set in the given pass: it is not
+ * 				picked yet, and on the first pass with zones no replica shares its zone
+ */
+bool Partitioner::fits(Node &candidate, vector<Node> &replicas, int pass) {
+	if (replicas.size() >= PARTITION_REPLICAS) {
+		return false;
+	}
+	int zone = candidate.getAddress()->getZone(zones);
+	for (size_t k = 0; k < replicas.size(); k++) {
+		if (sameNode(replicas[k], candidate) || (pass == 0 && zones > 1 && replicas[k].getAddress()->getZone(zones) == zone)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * FUNCTION NAME: setNodes
+ *
+ * DESCRIPTION: Take the ring, sorted by hash code
+ */
+void RingPartitioner::setNodes(vector<Node> &ringNodes) {
+	ring = ringNodes;
+}
+
+/**
+ * FUNCTION NAME: walk
+ *
+ * DESCRIPTION: Pick the nodes of the given token and the tokens after it, skipping nodes
+ * 				already picked, and with zones nodes in zones already picked while any
+ * 				other zone is left
+ */
+void RingPartitioner::walk(size_t first, vector<Node> &replicas) {
+	replicas.clear();
+	for (int pass = 0; pass < passes(); pass++) {
+		for (size_t j = first; replicas.size() < PARTITION_REPLICAS && j < first + ring.size(); j++) {
+			if (fits(ring[j % ring.size()], replicas, pass)) {
+				replicas.push_back(ring[j % ring.size()]);
+			}
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: replicasAt
+ *
+ * DESCRIPTION: Binary search the ring for the first token not below the position,
+ * 				wrapping around to the first token, and walk on from there
+ */
+void RingPartitioner::replicasAt(uint64_t position, vector<Node> &replicas) {
+	vector<Node>::iterator it = lower_bound(ring.begin(), ring.end(), position, [](Node &node, uint64_t position) {
+		return node.getHashCode() < position;
+	});
+	walk(it == ring.end() ? 0 : it - ring.begin(), replicas);
+}
+
+/**
+ * FUNCTION NAME: ranges
+ *
+ * DESCRIPTION: One range per token, ending at its hash code
+ */
+void RingPartitioner::ranges(vector<uint64_t> &ends, vector<vector<Node> > &replicaSets) {
+	ends.resize(ring.size());
+	replicaSets.resize(ring.size());
+	for (size_t i = 0; i < ring.size(); i++) {
+		ends[i] = ring[i].getHashCode();
+		walk(i, replicaSets[i]);
+	}
+}
+
+/**
+ * FUNCTION NAME: setNodes
+ *
+ * DESCRIPTION: Take the nodes of the ring, whatever their tokens, and size the slices
+ * 				for them
+ */
+void SlicePartitioner::setNodes(vector<Node> &ringNodes) {
+	distinctNodes(ringNodes, nodes);
+	size_t wanted = PARTITION_SLICES_PER_NODE * max(nodes.size(), (size_t)1);
+	sliceBits = 1;
+	while (((size_t)1 << sliceBits) < wanted) {
+		sliceBits++;
+	}
+}
+
+/**
+ * FUNCTION NAME: sliceStart
+ *
+ * DESCRIPTION: The first position of the slice holding the given position
+ */
+uint64_t SlicePartitioner::sliceStart(uint64_t position) {
+	return position & ~((~(uint64_t)0) >> sliceBits);
+}
+
+/**
+ * FUNCTION NAME: ranges
+ *
+ * DESCRIPTION: One range per run of neighbouring slices with the same replicas
+ */
+void SlicePartitioner::ranges(vector<uint64_t> &ends, vector<vector<Node> > &replicaSets) {
+	ends.clear();
+	replicaSets.clear();
+	vector<Node> replicas;
+	for (uint64_t slice = 0; slice < ((uint64_t)1 << sliceBits); slice++) {
+		uint64_t end = ((slice + 1) << (64 - sliceBits)) - 1;
+		replicasAt(end, replicas);
+		bool same = !replicaSets.empty();
+		for (size_t k = 0; same && k < replicas.size(); k++) {
+			same = sameNode(replicas[k], replicaSets.back()[k]);
+		}
+		if (same) {
+			ends.back() = end;
+		} else {
+			ends.push_back(end);
+			replicaSets.push_back(replicas);
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: replicasAt
+ *
+ * DESCRIPTION: Score every node for the slice of the position, hashing its address with
+ * 				the slice, and keep the top scorers, highest first. A node joining or
+ * 				leaving only changes the slices it scores among the top. With zones all
+ * 				the nodes are ranked, and the top scorer of each zone goes first.
+ */
+void RendezvousPartitioner::replicasAt(uint64_t position, vector<Node> &replicas) {
+	char bytes[sizeof(Address::addr) + 8];
+	putSlice(bytes + sizeof(Address::addr), sliceStart(position));
+
+	replicas.clear();
+	if (zones > 1) {
+		vector<pair<uint64_t, size_t> > ranked;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			memcpy(bytes, nodes[i].getAddress()->addr, sizeof(Address::addr));
+			ranked.push_back(make_pair(stableHash(bytes, sizeof(bytes)), i));
+		}
+		sort(ranked.rbegin(), ranked.rend());
+		for (int pass = 0; pass < passes(); pass++) {
+			for (size_t i = 0; i < ranked.size(); i++) {
+				if (fits(nodes[ranked[i].second], replicas, pass)) {
+					replicas.push_back(nodes[ranked[i].second]);
+				}
+			}
+		}
+		return;
+	}
+
+	uint64_t score[PARTITION_REPLICAS];
+	size_t top[PARTITION_REPLICAS];
+	size_t count = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		memcpy(bytes, nodes[i].getAddress()->addr, sizeof(Address::addr));
+		uint64_t s = stableHash(bytes, sizeof(bytes));
+		if (count == PARTITION_REPLICAS && s <= score[count - 1]) {
+			continue;
+		}
+		size_t k = count < PARTITION_REPLICAS ? count++ : count - 1;
+		for (; k > 0 && score[k - 1] < s; k--) {
+			score[k] = score[k - 1];
+			top[k] = top[k - 1];
+		}
+		score[k] = s;
+		top[k] = i;
+	}
+	for (size_t k = 0; k < count; k++) {
+		replicas.push_back(nodes[top[k]]);
+	}
+}
+
+/**
+ * FUNCTION NAME: jumpHash
+ *
+ * DESCRIPTION: Lamping and Veach's jump consistent hash. Spreads keys over the given
+ * 				number of buckets, and moves only the keys of the last bucket when it is
+ * 				taken away. Taking away any other bucket renumbers the ones after it.
+ */
+int32_t jumpHash(uint64_t key, int32_t buckets) {
+	int64_t b = -1, j = 0;
+	while (j < buckets) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (int64_t)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+	}
+	return (int32_t)b;
+}
+
+/**
+ * FUNCTION NAME: replicasAt
+ *
+ * DESCRIPTION: Jump the hashed slice of the position to a node, and take that node and
+ * 				the nodes after it, with zones the first of each zone
+ */
+void JumpPartitioner::replicasAt(uint64_t position, vector<Node> &replicas) {
+	char bytes[8];
+	putSlice(bytes, sliceStart(position));
+	size_t first = jumpHash(stableHash(bytes, sizeof(bytes)), nodes.size());
+	replicas.clear();
+	for (int pass = 0; pass < passes(); pass++) {
+		for (size_t k = 0; replicas.size() < PARTITION_REPLICAS && k < nodes.size(); k++) {
+			if (fits(nodes[(first + k) % nodes.size()], replicas, pass)) {
+				replicas.push_back(nodes[(first + k) % nodes.size()]);
+			}
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: makePartitioner
+ *
+ * DESCRIPTION: A new partitioner of the given kind over the given number of zones, the
+ * 				ring for any unknown kind
+ */
+Partitioner *makePartitioner(int kind, int zones) {
+	switch (kind) {
+		case RENDEZVOUS_PARTITIONER:
+			return new RendezvousPartitioner(zones);
+		case JUMP_PARTITIONER:
+			return new JumpPartitioner(zones);
+		default:
+			return new RingPartitioner(zones);
+	}
+}
@@ -0,0 +1,112 @@
+/**********************************
+ * FILE NAME: Partitioner.h
+ *
+ * DESCRIPTION: Header file of the partitioners placing ring positions on replicas
+ **********************************/
+
+#ifndef PARTITIONER_H_
+#define PARTITIONER_H_
+
+#include "stdincludes.h"
+#include "Node.h"
+#include "StableHash.h"
+
+/**
+ * Macros
+ */
+#define PARTITION_REPLICAS 3
+#define PARTITION_SLICES_PER_NODE 64
+
+/**
+ * The partitioners, by their PARTITIONER parameter value
+ */
+enum PartitionerKind {RING_PARTITIONER, RENDEZVOUS_PARTITIONER, JUMP_PARTITIONER};
+
+/**
+ * CLASS NAME: Partitioner
+ *
+ * DESCRIPTION: Places every position of the 2^64 ring on PARTITION_REPLICAS nodes.
+ * 				replicasAt answers for one position, and ranges compiles the whole ring
+ * 				into consecutive ranges, each named by its last position, with the same
+ * 				answers. Both need at least PARTITION_REPLICAS distinct nodes. With more
+ * 				than one zone the replicas go to as many different zones as there are.
+ */
+class Partitioner {
+protected:
+	int zones;
+	bool fits(Node &candidate, vector<Node> &replicas, int pass);
+	int passes();
+public:
+	Partitioner(int zones) : zones(zones) {}
+	virtual ~Partitioner() {}
+	virtual void setNodes(vector<Node> &ringNodes) = 0;
+	virtual void replicasAt(uint64_t position, vector<Node> &replicas) = 0;
+	virtual void ranges(vector<uint64_t> &ends, vector<vector<Node> > &replicaSets) = 0;
+};
+
+/**
+ * CLASS NAME: RingPartitioner
+ *
+ * DESCRIPTION: Consistent hashing. A position belongs to the first token not below it
+ * 				and is replicated on the nodes of that token and the tokens after it.
+ */
+class RingPartitioner : public Partitioner {
+private:
+	vector<Node> ring;
+	void walk(size_t first, vector<Node> &replicas);
+public:
+	RingPartitioner(int zones) : Partitioner(zones) {}
+	void setNodes(vector<Node> &ringNodes);
+	void replicasAt(uint64_t position, vector<Node> &replicas);
+	void ranges(vector<uint64_t> &ends, vector<vector<Node> > &replicaSets);
+};
+
+/**
+ * CLASS NAME: SlicePartitioner
+ *
+ * DESCRIPTION: A partitioner placing equal slices of the ring rather than single
+ * 				positions. The slice count is the power of two at or above
+ * 				PARTITION_SLICES_PER_NODE times the node count, so that every node gets
+ * 				about as many slices whatever the cluster size. Doubling the count splits
+ * 				every slice in two, and the first half keeps the old slice's placement.
+ */
+class SlicePartitioner : public Partitioner {
+protected:
+	vector<Node> nodes;
+	int sliceBits;
+	uint64_t sliceStart(uint64_t position);
+public:
+	SlicePartitioner(int zones) : Partitioner(zones), sliceBits(0) {}
+	void setNodes(vector<Node> &ringNodes);
+	void ranges(vector<uint64_t> &ends, vector<vector<Node> > &replicaSets);
+};
+
+/**
+ * CLASS NAME: RendezvousPartitioner
+ *
+ * DESCRIPTION: Highest random weight hashing over the slices of the ring. Each node
+ * 				scores every slice, and a slice is replicated on its top scorers.
+ */
+class RendezvousPartitioner : public SlicePartitioner {
+public:
+	RendezvousPartitioner(int zones) : SlicePartitioner(zones) {}
+	void replicasAt(uint64_t position, vector<Node> &replicas);
+};
+
+/**
+ * CLASS NAME: JumpPartitioner
+ *
+ * DESCRIPTION: Jump consistent hashing over the slices of the ring. A slice jumps to one
+ * 				of the nodes sorted by address and is replicated there and on the nodes
+ * 				after it.
+ */
+class JumpPartitioner : public SlicePartitioner {
+public:
+	JumpPartitioner(int zones) : SlicePartitioner(zones) {}
+	void replicasAt(uint64_t position, vector<Node> &replicas);
+};
+
+Partitioner *makePartitioner(int kind, int zones);
+int32_t jumpHash(uint64_t key, int32_t buckets);
+
+#endif /* PARTITIONER_H_ */
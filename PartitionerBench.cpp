@@ -0,0 +1,152 @@
+/**********************************
+ * FILE NAME: PartitionerBench.cpp
+ *
+ * DESCRIPTION: Microbenchmark of the partitioners. For a few cluster sizes it times a
+ * 				replica lookup and a full compile into ranges, measures how evenly the
+ * 				keys spread over the nodes, and counts the replica copies that move when
+ * 				a node joins or leaves. Built by make bench.
+ **********************************/
+
+#include "Partitioner.h"
+#include <chrono>
+
+#define BENCH_KEYS 100000
+#define BENCH_TOKENS 16
+
+/**
+ * FUNCTION NAME: buildRing
+ *
+ * DESCRIPTION: A ring of the given nodes with the given tokens each, sorted by hash code
+ */
+static void buildRing(vector<int> &ids, int tokens, vector<Node> &ring) {
+	ring.clear();
+	for (size_t i = 0; i < ids.size(); i++) {
+		for (int token = 0; token < tokens; token++) {
+			ring.push_back(Node(Address(to_string(ids[i]) + ":0"), token));
+		}
+	}
+	sort(ring.begin(), ring.end());
+}
+
+/**
+ * FUNCTION NAME: placeKeys
+ *
+ * DESCRIPTION: The replica addresses of every key position
+ */
+static void placeKeys(Partitioner &partitioner, vector<uint64_t> &positions, vector<vector<string> > &placement) {
+	vector<Node> replicas;
+	placement.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		partitioner.replicasAt(positions[i], replicas);
+		placement[i].clear();
+		for (size_t k = 0; k < replicas.size(); k++) {
+			placement[i].push_back(replicas[k].getAddress()->getAddress());
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: copiesMoved
+ *
+ * DESCRIPTION: The share of replica copies placed on a node that did not hold them before
+ */
+static double copiesMoved(vector<vector<string> > &before, vector<vector<string> > &after) {
+	long moved = 0, copies = 0;
+	for (size_t i = 0; i < after.size(); i++) {
+		for (size_t k = 0; k < after[i].size(); k++) {
+			moved += find(before[i].begin(), before[i].end(), after[i][k]) == before[i].end();
+		}
+		copies += after[i].size();
+	}
+	return copies > 0 ? (double)moved / copies : 0;
+}
+
+/**
+ * FUNCTION NAME: loadSpread
+ *
+ * DESCRIPTION: The most keys held by one node over the mean keys held per node, counting
+ * 				a key on every one of its replicas and every node of the cluster
+ */
+static double loadSpread(vector<vector<string> > &placement, int nodes) {
+	map<string, long> held;
+	long copies = 0, most = 0;
+	for (size_t i = 0; i < placement.size(); i++) {
+		for (size_t k = 0; k < placement[i].size(); k++) {
+			most = max(most, ++held[placement[i][k]]);
+		}
+		copies += placement[i].size();
+	}
+	return copies > 0 ? (double)most * nodes / copies : 0;
+}
+
+/**
+ * FUNCTION NAME: bench
+ *
+ * DESCRIPTION: Time one partitioner on a cluster of the given size, then have one node
+ * 				join and one from the middle leave
+ */
+static void bench(const char *name, int kind, int tokens, int nodes, vector<uint64_t> &positions) {
+	Partitioner *partitioner = makePartitioner(kind, 1);
+	vector<int> ids;
+	for (int i = 1; i <= nodes; i++) {
+		ids.push_back(i);
+	}
+	vector<Node> ring;
+	buildRing(ids, tokens, ring);
+	partitioner->setNodes(ring);
+
+	vector<Node> replicas;
+	uint64_t checksum = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < positions.size(); i++) {
+		partitioner->replicasAt(positions[i], replicas);
+		checksum += replicas[0].getHashCode();
+	}
+	double lookupNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / positions.size();
+
+	vector<uint64_t> ends;
+	vector<vector<Node> > replicaSets;
+	start = chrono::steady_clock::now();
+	partitioner->ranges(ends, replicaSets);
+	double compileUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+	vector<vector<string> > before, joined, left;
+	placeKeys(*partitioner, positions, before);
+	ids.push_back(nodes + 1);
+	buildRing(ids, tokens, ring);
+	partitioner->setNodes(ring);
+	placeKeys(*partitioner, positions, joined);
+	ids.pop_back();
+	ids.erase(ids.begin() + nodes / 2);
+	buildRing(ids, tokens, ring);
+	partitioner->setNodes(ring);
+	placeKeys(*partitioner, positions, left);
+
+	printf("%-12s %5d %8.1f %10.1f %7zu %8.2f %8.2f%% %8.2f%% %8.2f%% (%llx)\n", name, nodes, lookupNs, compileUs,
+			ends.size(), loadSpread(before, nodes), 100 * copiesMoved(before, joined), 100 * copiesMoved(before, left),
+			100.0 / nodes, (unsigned long long)(checksum & 0xff));
+	delete partitioner;
+}
+
+/**
+ * FUNCTION NAME: main
+ *
+ * DESCRIPTION: Bench every partitioner on 10, 100 and 1000 nodes. The ideal share of
+ * 				copies moved is one node's share, 1/n, and the ideal spread is 1.
+ */
+int main() {
+	vector<uint64_t> positions;
+	for (int i = 0; i < BENCH_KEYS; i++) {
+		positions.push_back(stableHash("key" + to_string(i)));
+	}
+	printf("%-12s %5s %8s %10s %7s %8s %9s %9s %9s\n", "partitioner", "nodes", "ns/look", "compile us",
+			"ranges", "max/mean", "join", "leave", "ideal");
+	int sizes[] = {10, 100, 1000};
+	for (int s = 0; s < 3; s++) {
+		bench("ring", RING_PARTITIONER, 1, sizes[s], positions);
+		bench("ring vnodes", RING_PARTITIONER, BENCH_TOKENS, sizes[s], positions);
+		bench("rendezvous", RENDEZVOUS_PARTITIONER, 1, sizes[s], positions);
+		bench("jump", JUMP_PARTITIONER, 1, sizes[s], positions);
+	}
+	return 0;
+}
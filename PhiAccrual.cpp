@@ -0,0 +1,100 @@
+/**********************************
+ * FILE NAME: PhiAccrual.cpp
+ *
+ * DESCRIPTION: Definition of the phi accrual failure detector
+ **********************************/
+
+#include "PhiAccrual.h"
+
+/**
+ * FUNCTION NAME: add
+ *
+ * DESCRIPTION: Record a heartbeat arrival, dropping the oldest interval once the window is full
+ */
+void ArrivalWindow::add(int now) {
+	if (lastArrival >= 0) {
+		int interval = now - lastArrival;
+		intervals.push_back(interval);
+		sum += interval;
+		sumOfSquares += (long)interval * interval;
+		if (intervals.size() > PHI_WINDOW_SIZE) {
+			sum -= intervals.front();
+			sumOfSquares -= (long)intervals.front() * intervals.front();
+			intervals.pop_front();
+		}
+	}
+	lastArrival = now;
+}
+
+/**
+ * FUNCTION NAME: mean
+ *
+ * DESCRIPTION: Mean inter-arrival time
+ */
+double ArrivalWindow::mean() {
+	return intervals.empty() ? 0.0 : (double)sum / intervals.size();
+}
+
+/**
+ * FUNCTION NAME: stdDeviation
+ *
+ * DESCRIPTION: Standard deviation of the inter-arrival times, never below PHI_MIN_STD_DEVIATION
+ */
+double ArrivalWindow::stdDeviation() {
+	if (intervals.empty()) {
+		return PHI_MIN_STD_DEVIATION;
+	}
+	double m = mean();
+	double variance = (double)sumOfSquares / intervals.size() - m * m;
+	return max(sqrt(max(variance, 0.0)), PHI_MIN_STD_DEVIATION);
+}
+
+/**
+ * FUNCTION NAME: heartbeat
+ *
+ * DESCRIPTION: Record that a member's heartbeat moved at time now
+ */
+void PhiAccrual::heartbeat(long key, int now) {
+	windows[key].add(now);
+}
+
+/**
+ * FUNCTION NAME: phi
+ *
+ * DESCRIPTION: Suspicion level of a member at time now. The inter-arrival times are
+ *              taken as normally distributed, shifted by PHI_ACCEPTABLE_PAUSE, and the
+ *              tail of the normal distribution uses the logistic approximation.
+ */
+double PhiAccrual::phi(long key, int now) {
+	map<long, ArrivalWindow>::iterator found = windows.find(key);
+	if (found == windows.end() || found->second.lastArrival < 0) {
+		return 0.0;
+	}
+	ArrivalWindow &window = found->second;
+	double elapsed = now - window.lastArrival;
+	double y = (elapsed - window.mean() - PHI_ACCEPTABLE_PAUSE) / window.stdDeviation();
+	double e = exp(-y * (1.5976 + 0.070566 * y * y));
+	if (elapsed > window.mean() + PHI_ACCEPTABLE_PAUSE) {
+		return -log10(e / (1.0 + e));
+	}
+	return -log10(1.0 - 1.0 / (1.0 + e));
+}
+
+/**
+ * FUNCTION NAME: samples
+ *
+ * DESCRIPTION: Number of inter-arrival times seen for a member
+ */
+int PhiAccrual::samples(long key) {
+	map<long, ArrivalWindow>::iterator found = windows.find(key);
+	return found == windows.end() ? 0 : found->second.intervals.size();
+}
+
+/**
+ * FUNCTION NAME: remove
+ *
+ * DESCRIPTION: Forget a member
+ */
+void PhiAccrual::remove(long key) {
+	windows.erase(key);
+}
@@ -0,0 +1,60 @@
+/**********************************
+ * FILE NAME: PhiAccrual.h
+ *
+ * DESCRIPTION: Header file of the phi accrual failure detector
+ **********************************/
+
+#ifndef PHIACCRUAL_H_
+#define PHIACCRUAL_H_
+
+#include "stdincludes.h"
+#include <deque>
+
+/**
+ * Macros
+ *
+ * The deviation floor and the acceptable pause keep a member that heartbeats every
+ * tick from being suspected after a couple of dropped messages. With the default
+ * threshold of 8 such a member is removed after about 17 silent ticks.
+ */
+#define PHI_WINDOW_SIZE 100
+#define PHI_MIN_STD_DEVIATION 2.0
+#define PHI_ACCEPTABLE_PAUSE 5
+
+/**
+ * CLASS NAME: ArrivalWindow
+ *
+ * DESCRIPTION: The last PHI_WINDOW_SIZE heartbeat inter-arrival times of one member
+ */
+class ArrivalWindow {
+public:
+	deque<int> intervals;
+	long sum;
+	long sumOfSquares;
+	int lastArrival;
+	ArrivalWindow(): sum(0), sumOfSquares(0), lastArrival(-1) {}
+	void add(int now);
+	double mean();
+	double stdDeviation();
+};
+
+/**
+ * CLASS NAME: PhiAccrual
+ *
+ * DESCRIPTION: Phi accrual failure detector. Instead of a fixed timeout it reports how
+ *              unlikely the current silence of a member is, given the heartbeat
+ *              inter-arrival times seen so far, as phi = -log10(P(silence this long)).
+ */
+class PhiAccrual {
+private:
+	map<long, ArrivalWindow> windows;
+public:
+	PhiAccrual() {}
+	void heartbeat(long key, int now);
+	double phi(long key, int now);
+	int samples(long key);
+	void remove(long key);
+	virtual ~PhiAccrual() {}
+};
+
+#endif /* PHIACCRUAL_H_ */
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+#################################################
+# FILE NAME: ScenarioTests.sh
+#
+# DESCRIPTION: Scenario tests of the KV store. Every conf in testcases/scenarios runs
+#              the create test with a SCENARIO injecting faults, and passes if the run
+#              exits cleanly, logs a SCENARIO PASS line and no SCENARIO FAIL line.
+#
+# RUN PROCEDURE:
+# $ make test
+#################################################
+
+FAILED=0
+for conf in ./testcases/scenarios/*.conf
+do
+	name=$(basename "${conf}" .conf)
+	rm -f dbg.log
+	./Application "${conf}" > /dev/null 2>&1
+	status=$?
+	passed=$(grep -c "SCENARIO PASS" dbg.log 2>/dev/null)
+	failed=$(grep -c "SCENARIO FAIL" dbg.log 2>/dev/null)
+	if [ "${status}" -eq 0 ] && [ "${passed:-0}" -gt 0 ] && [ "${failed:-0}" -eq 0 ]; then
+		echo "${name}: PASS"
+	else
+		echo "${name}: FAIL (exit ${status})"
+		grep "SCENARIO" dbg.log 2>/dev/null
+		FAILED=$((FAILED + 1))
+	fi
+done
+
+echo "${FAILED} scenario(s) failed"
+exit ${FAILED}
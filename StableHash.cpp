@@ -0,0 +1,128 @@
+/**********************************
+ * FILE NAME: StableHash.cpp
+ *
+ * DESCRIPTION: Definition of the 64 bit hash placing keys and nodes on the ring
+ **********************************/
+
+#include "StableHash.h"
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+
+static inline uint64_t rotateLeft(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * FUNCTION NAME: read64
+ *
+ * DESCRIPTION: Read 8 bytes as a little endian number
+ */
+static inline uint64_t read64(const unsigned char *p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t block;
+	memcpy(&block, p, sizeof(block));
+	return block;
+#else
+	uint64_t block = 0;
+	for (int i = 0; i < 8; i++) {
+		block |= (uint64_t)p[i] << (8 * i);
+	}
+	return block;
+#endif
+}
+
+/**
+ * FUNCTION NAME: read32
+ *
+ * DESCRIPTION: Read 4 bytes as a little endian number
+ */
+static inline uint64_t read32(const unsigned char *p) {
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24;
+}
+
+/**
+ * FUNCTION NAME: readTail
+ *
+ * DESCRIPTION: Read the last 1 to 7 bytes of the input as one block, without a loop.
+ * 				From 4 bytes on the first and last 4 may overlap, which is harmless as
+ * 				the length has already gone into the hash state.
+ */
+static inline uint64_t readTail(const unsigned char *p, size_t length) {
+	if (length >= 4) {
+		return read32(p) | read32(p + length - 4) << 32;
+	}
+	return (uint64_t)p[0] | (uint64_t)p[length / 2] << 8 | (uint64_t)p[length - 1] << 16;
+}
+
+/**
+ * FUNCTION NAME: mixBlock
+ *
+ * DESCRIPTION: Fold one block into the hash state
+ */
+static inline uint64_t mixBlock(uint64_t h, uint64_t block) {
+	h ^= rotateLeft(block * PRIME2, 31) * PRIME1;
+	return rotateLeft(h, 27) * PRIME1 + PRIME3;
+}
+
+/**
+ * FUNCTION NAME: avalanche
+ *
+ * DESCRIPTION: Spread every input bit over the whole result
+ */
+static inline uint64_t avalanche(uint64_t h) {
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+/**
+ * FUNCTION NAME: finish
+ *
+ * DESCRIPTION: Fold the rest of the input from p on into the hash state and finalize it
+ */
+static inline uint64_t finish(uint64_t h, const unsigned char *p, size_t length) {
+	for (; length >= 8; p += 8, length -= 8) {
+		h = mixBlock(h, read64(p));
+	}
+	if (length > 0) {
+		h = mixBlock(h, readTail(p, length));
+	}
+	return avalanche(h);
+}
+
+/**
+ * FUNCTION NAME: stableHash
+ *
+ * DESCRIPTION: Hash length bytes of data to a position on the 2^64 ring
+ */
+uint64_t stableHash(const char *data, size_t length) {
+	return finish(length * PRIME1 + PRIME3, (const unsigned char *)data, length);
+}
+
+/**
+ * FUNCTION NAME: stableHash
+ *
+ * DESCRIPTION: Hash a key to a position on the 2^64 ring
+ */
+uint64_t stableHash(const string &key) {
+	return stableHash(key.data(), key.size());
+}
+
+/**
+ * FUNCTION NAME: stableHashBatch
+ *
+ * DESCRIPTION: Hash many keys at once, giving the same results as stableHash. The keys
+ * 				are hashed in a tight loop with no lookups in between, so the CPU overlaps
+ * 				their independent multiply chains.
+ */
+void stableHashBatch(const vector<string> &keys, vector<uint64_t> &hashes) {
+	hashes.resize(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		hashes[i] = stableHash(keys[i]);
+	}
+}
@@ -0,0 +1,20 @@
+/**********************************
+ * FILE NAME: StableHash.h
+ *
+ * DESCRIPTION: Header file of the 64 bit hash placing keys and nodes on the ring
+ **********************************/
+
+#ifndef STABLEHASH_H_
+#define STABLEHASH_H_
+
+#include "stdincludes.h"
+
+/**
+ * The hash reads its input as little endian 64 bit blocks, so a key lands on the same
+ * ring position whatever the platform or standard library.
+ */
+uint64_t stableHash(const char *data, size_t length);
+uint64_t stableHash(const string &key);
+void stableHashBatch(const vector<string> &keys, vector<uint64_t> &hashes);
+
+#endif /* STABLEHASH_H_ */
@@ -9,7 +9,7 @@ static int g_transID = 0;
 
 
 // message types, reply is the message from node to coordinator
-enum MessageType {CREATE, READ, UPDATE, DELETE, REPLY, READREPLY};
+enum MessageType {CREATE, READ, UPDATE, DELETE, REPLY, READREPLY, HANDOFF, STREAM, STREAM_ACK, MERKLE, REPAIR, HINT, HINT_ACK};
 // enum of replica types
 enum ReplicaType {PRIMARY, SECONDARY, TERTIARY};
 
@@ -10,7 +10,8 @@
 /*
  * Macros
  */
-#define RING_SIZE 512
+#define RING_SIZE 512			// buckets of the 2^64 ring in the replica lookup table
+#define RING_BUCKET_SHIFT 55	// log2(2^64 / RING_SIZE)
 #define FAILURE -1
 #define SUCCESS 0
 
@@ -34,6 +35,9 @@
 #include <string>
 #include <algorithm>
 #include <queue>
+#include <deque>
+#include <set>
+#include <stdint.h>
 #include <fstream>
 
 using namespace std;